@@ -1,6 +1,9 @@
 #ifndef _SQLDB_CONNECTION_H_
 #define _SQLDB_CONNECTION_H_
 
+#include "MemoryTracker.h"
+
+#include <chrono>
 #include <string>
 #include <memory>
 
@@ -18,10 +21,34 @@ namespace sqldb {
     virtual void begin();
     virtual void commit();
     virtual void rollback();
+    virtual void savepoint(const std::string & name);
+    virtual void releaseSavepoint(const std::string & name);
+    virtual void rollbackToSavepoint(const std::string & name);
     virtual unsigned int execute(const char * query);
     virtual bool ping() { return true; }    
     
     unsigned int execute(const std::string & query) { return execute(query.c_str()); }
+
+    // Default timeout of statements prepared after this call, zero for none.
+    // A statement that runs out of time fails with QUERY_TIMED_OUT.
+    void setQueryTimeout(std::chrono::milliseconds _query_timeout) { query_timeout = _query_timeout; }
+    std::chrono::milliseconds getQueryTimeout() const { return query_timeout; }
+    // Stops the query running on this connection from another thread. The
+    // query fails with QUERY_CANCELLED and the connection stays usable.
+    virtual void cancel() { }
+
+    // Tracks the memory of statements prepared after this call, with limits
+    // for the whole connection (see MemoryTracker). Zero limits are unlimited.
+    void setMemoryLimits(size_t soft_limit, size_t hard_limit);
+    MemoryTracker * getMemoryTracker() const { return memory_tracker.get(); }
+
+  protected:
+    // Returns a tracker for a new statement, or null if tracking is off
+    std::shared_ptr<MemoryTracker> createStatementTracker() const;
+
+  private:
+    std::shared_ptr<MemoryTracker> memory_tracker;
+    std::chrono::milliseconds query_timeout{0};
   };
 };
 
@@ -0,0 +1,50 @@
+#ifndef _SQLDB_MEMORYTRACKER_H_
+#define _SQLDB_MEMORYTRACKER_H_
+
+#include <atomic>
+#include <memory>
+#include <memory_resource>
+
+namespace sqldb {
+  // Memory resource that counts the bytes allocated through it and the
+  // bytes reported with add(), and passes them on to its parent. A statement
+  // has a tracker whose parent is the tracker of its connection.
+  class MemoryTracker : public std::pmr::memory_resource {
+  public:
+    MemoryTracker(std::shared_ptr<MemoryTracker> _parent = nullptr, std::pmr::memory_resource * _upstream = 0);
+    ~MemoryTracker();
+
+    // Zero limits are unlimited. Going over the hard limit throws
+    // SQLException::RESOURCE_LIMIT. Backends that can stream results do so
+    // when the soft limit has been reached or a row could exceed the
+    // memory that is left.
+    void setLimits(size_t _soft_limit, size_t _hard_limit) { soft_limit = _soft_limit; hard_limit = _hard_limit; }
+    size_t getSoftLimit() const { return soft_limit; }
+    size_t getHardLimit() const { return hard_limit; }
+
+    // Counts memory that is not allocated from this resource
+    void add(size_t bytes);
+    void remove(size_t bytes);
+
+    size_t getUsage() const { return usage; }
+    size_t getPeakUsage() const { return peak_usage; }
+    // True if this tracker or a parent is over its soft limit
+    bool isOverSoftLimit() const;
+    // Bytes left below the nearest limit of this tracker or a parent,
+    // SIZE_MAX if there are no limits
+    size_t getAvailable() const;
+
+  protected:
+    void * do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void * p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override { return this == &other; }
+
+  private:
+    std::shared_ptr<MemoryTracker> parent;
+    std::pmr::memory_resource * upstream;
+    std::atomic<size_t> usage{0}, peak_usage{0};
+    size_t soft_limit = 0, hard_limit = 0;
+  };
+};
+
+#endif
@@ -5,6 +5,13 @@
 #include "SQLStatement.h"
 
 #include <mysql.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #define MYSQL_MAX_BOUND_VARIABLES 255
@@ -12,16 +19,46 @@
 // #define MYSQL_BIND_BUFFER_SIZE 64
 
 namespace sqldb {
+  // Client options applied before connecting. Zero timeouts and sizes keep
+  // the client library defaults.
+  struct MySQLOptions {
+    enum Compression { COMPRESSION_NONE = 0, COMPRESSION_ZLIB, COMPRESSION_ZSTD };
+
+    Compression compression = COMPRESSION_NONE;
+    unsigned int zstd_level = 3;
+    unsigned int connect_timeout = 0, read_timeout = 0, write_timeout = 0; // seconds
+    std::string unix_socket; // used instead of TCP if set
+    unsigned long max_allowed_packet = 0;
+    std::string charset = "utf8mb4";
+    bool found_rows = true; // affected rows counts matched rows (CLIENT_FOUND_ROWS)
+    std::vector<std::pair<std::string, std::string> > connect_attributes;
+  };
+
+  class MySQLWatchdog;
+
   class MySQL : public Connection {
   public:
     MySQL() { }
     ~MySQL();
     
-    bool connect(const std::string & host_name, int port, const std::string & user_name, const std::string & password, const std::string & db_name);    
+    bool connect(const std::string & host_name, int port, const std::string & user_name, const std::string & password, const std::string & db_name, const MySQLOptions & options = MySQLOptions());
     bool connect();
+
+    const MySQLOptions & getOptions() const { return options; }
+
+    // GTID of the last transaction committed on this connection, or empty if
+    // the server does not track it (requires session_track_gtids = OWN_GTID)
+    std::string getLastGTID() const;
+    // False if the client library cannot read tracked GTIDs (MariaDB or
+    // older than MySQL 5.7), in which case getLastGTID() is always empty
+    static bool hasGTIDTracking();
+    // Waits until the server has applied the GTID set. Returns false on timeout.
+    bool waitForGTID(const std::string & gtid_set, unsigned int timeout_seconds);
     
     std::shared_ptr<SQLStatement> prepare(const std::string & query) override;
     bool ping() override;
+    // Kills the running query with KILL QUERY from a side connection
+    void cancel() override;
     void begin() override;
     void commit() override;
     void rollback() override;
@@ -32,16 +69,65 @@ namespace sqldb {
     MYSQL * conn = 0;
     std::string host_name, user_name, password, db_name;
     int port = 0;
+    MySQLOptions options;
+    std::shared_ptr<MySQLWatchdog> watchdog;
+
+    bool setOptions();
+  };
+
+  // Enforces query timeouts of a connection by killing its running query
+  // with KILL QUERY from a side connection, which leaves the connection
+  // usable. The thread and the side connection are created on first use.
+  class MySQLWatchdog {
+  public:
+    MySQLWatchdog(const std::string & _host_name, int _port, const std::string & _user_name, const std::string & _password, const MySQLOptions & _options)
+      : host_name(_host_name), user_name(_user_name), password(_password), port(_port), options(_options) { }
+    MySQLWatchdog(const MySQLWatchdog & other) = delete;
+    ~MySQLWatchdog();
+    MySQLWatchdog & operator=(const MySQLWatchdog & other) = delete;
+
+    void setThreadId(unsigned long _thread_id);
+    // Starts the deadline for the query that is about to run
+    void arm(std::chrono::milliseconds timeout);
+    // Ends the deadline and returns true if the query was killed by it
+    bool disarm();
+    void cancel();
+
+  private:
+    void run();
+    void kill();
+
+    std::string host_name, user_name, password;
+    int port;
+    MySQLOptions options;
+    std::unique_ptr<MySQL> side;
+    unsigned long thread_id = 0;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread thread;
+    std::chrono::steady_clock::time_point deadline;
+    bool is_armed = false, has_fired = false, is_stopping = false;
   };
 
+  // Results are stored on the client after execute. Under memory pressure
+  // (see MemoryTracker) they are streamed instead, and the connection stays
+  // busy until the result has been read to the end or the statement reset:
+  // executing another statement on the same connection meanwhile fails with
+  // "Commands out of sync".
   class MySQLStatement : public SQLStatement {
   public:
-    MySQLStatement(MYSQL_STMT * _stmt, const std::string & _query);
+    MySQLStatement(MYSQL_STMT * _stmt, const std::string & _query, const std::vector<std::string> & parameter_names = std::vector<std::string>(), std::shared_ptr<MemoryTracker> tracker = nullptr);
     ~MySQLStatement();
     
     unsigned int execute() override;
     void reset() override;
     bool next() override;
+    void cancel() override;
+
+    void setWatchdog(std::shared_ptr<MySQLWatchdog> _watchdog) { watchdog = _watchdog; }
+
+    SQLStatus<unsigned int> tryExecute() override;
+    SQLStatus<bool> tryNext() override;
 
     MySQLStatement & bind(int value, bool is_defined = true) override;
     MySQLStatement & bind(long long value, bool is_defined = true) override;
@@ -52,37 +138,77 @@ namespace sqldb {
     MySQLStatement & bind(const std::string & value, bool is_defined = true) override;
     MySQLStatement & bind(const void * data, size_t len, bool is_defined = true) override;
     MySQLStatement & bind(double value, bool is_defined = true) override;
+    MySQLStatement & bindStream(std::istream & input, size_t len, bool is_defined = true) override;
+    void bindRow(const field_s * fields, unsigned int num_fields) override;
   
     int getInt(int column_index) override;
     unsigned int getUInt(int column_index) override;
     double getDouble(int column_index) override;
     long long getLongLong(int column_index) override;
     bool getBool(int column_index) override;
+    using SQLStatement::getText;
+    using SQLStatement::getBlob;
     std::string getText(int column_index) override;
     ustring getBlob(int column_index) override;
+
+    size_t getBlobSize(int column_index) override;
+    size_t readBlob(int column_index, size_t offset, void * buffer, size_t len) override;
+
+    bool isNull(int column_index) override;
+    void fetchRow(const field_s * fields, unsigned int num_fields) override;
     
     long long getLastInsertId() const { return last_insert_id; }
     unsigned int getAffectedRows() const { return rows_affected; }
-    unsigned int getNumFields() { return num_bound_variables; }
+    unsigned int getNumFields() { return columns.size(); }
     
   protected:
+    SQLStatus<unsigned int> executeQuery();
+    bool sendLongData();
+    void freeLargeBindBuffers();
+    void releaseResultMemory();
+    size_t getStoredResultSize();
+    size_t getRowSize() const;
+    bool armWatchdog();
+    SQLException::ErrorType getStatementError(bool has_fired);
+    const char * getErrorMessage(SQLException::ErrorType type);
+    void fetchColumn(int column_index, enum_field_types buffer_type, void * buffer, unsigned long len, bool is_unsigned = false);
     MySQLStatement & bindNull();
     MySQLStatement & bindData(enum_field_types buffer_type, const void * ptr, unsigned int size, bool is_defined = true, bool is_unsigned = false);
     
   private:
     MYSQL_STMT * stmt;
     unsigned int num_bound_variables = 0;       
-    bool has_result_set = false, is_query_executed = false;
+    bool has_result_set = false, is_query_executed = false, is_streaming = false;
     long long last_insert_id = 0;
     my_bool is_null = 1, is_not_null = 0;
     unsigned int rows_affected = 0;
+    size_t statement_memory = 0; // counted for the bind arrays and used buffer slots
+    size_t result_memory = 0; // estimated size of the stored result or the streamed row
+    std::shared_ptr<MySQLWatchdog> watchdog;
+    bool has_deadline = false;
+    std::chrono::steady_clock::time_point deadline; // covers execute, store and streamed fetches
 
     MYSQL_BIND bind_data[MYSQL_MAX_BOUND_VARIABLES];
     unsigned long bind_length[MYSQL_MAX_BOUND_VARIABLES];
     my_bool bind_is_null[MYSQL_MAX_BOUND_VARIABLES];
     my_bool bind_error[MYSQL_MAX_BOUND_VARIABLES];
     char bind_buffer[MYSQL_MAX_BOUND_VARIABLES * MYSQL_BIND_BUFFER_SIZE];
-    char * bind_ptr[MYSQL_MAX_BOUND_VARIABLES];
+
+    // binds larger than MYSQL_BIND_BUFFER_SIZE are copied into buffers from
+    // the statement's memory resource
+    struct large_buffer_s {
+      char * ptr;
+      size_t size;
+      std::pmr::memory_resource * resource;
+    };
+    large_buffer_s bind_ptr[MYSQL_MAX_BOUND_VARIABLES];
+
+    struct long_data_s {
+      unsigned int index;
+      std::istream * input;
+      size_t len;
+    };
+    std::vector<long_data_s> long_data;
   };
 };
 
@@ -0,0 +1,157 @@
+#ifndef _SQLDB_MYSQLROUTER_H_
+#define _SQLDB_MYSQLROUTER_H_
+
+#include "MySQL.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sqldb {
+  struct MySQLRouterOptions {
+    enum Balancing { ROUND_ROBIN = 1, LEAST_OUTSTANDING };
+    // How reads that follow a write of this session are routed
+    enum Consistency {
+      EVENTUAL = 1,            // any replica
+      READ_YOUR_WRITES_WINDOW, // the primary until sticky_window_ms has passed
+      READ_YOUR_WRITES_GTID    // a replica that has applied the last write (primary if none does in time)
+    };
+
+    Balancing balancing = ROUND_ROBIN;
+    Consistency consistency = EVENTUAL;
+    unsigned int sticky_window_ms = 1000;
+    unsigned int gtid_wait_timeout = 1; // seconds
+  };
+
+  // Queries on each replica whose results have not been read to the end yet.
+  // Share one between the routers of a connection pool so that
+  // LEAST_OUTSTANDING sees the load of all sessions.
+  class MySQLReplicaLoad {
+  public:
+    MySQLReplicaLoad(size_t num_replicas) : outstanding(num_replicas) { }
+
+    size_t size() const { return outstanding.size(); }
+    std::atomic<unsigned int> & operator[](size_t index) { return outstanding[index]; }
+
+  private:
+    std::vector<std::atomic<unsigned int> > outstanding;
+  };
+
+  // Session over one primary and its replicas. Plain SELECTs outside
+  // transactions are sent to a replica and everything else to the primary.
+  // Routing is decided on each execution, so a statement prepared once may
+  // run on several servers.
+  class MySQLRouter : public Connection {
+  public:
+    MySQLRouter(std::shared_ptr<MySQL> _primary, std::vector<std::shared_ptr<MySQL> > _replicas, const MySQLRouterOptions & _options = MySQLRouterOptions(), std::shared_ptr<MySQLReplicaLoad> _load = nullptr);
+
+    std::shared_ptr<SQLStatement> prepare(const std::string & query) override;
+    void begin() override;
+    void commit() override;
+    void rollback() override;
+    unsigned int execute(const char * query) override;
+    bool ping() override { return primary->ping(); }
+    void cancel() override;
+
+    MySQL & getPrimary() { return *primary; }
+    size_t getNumReplicas() const { return replicas.size(); }
+    MySQL & getReplica(size_t index) { return *replicas.at(index); }
+    bool inTransaction() const { return in_transaction; }
+
+    // True for SELECTs that take no locks
+    static bool isReadQuery(const std::string & query);
+
+    // Returns 0 for the primary or 1 + index of a replica
+    size_t route(bool is_read);
+    MySQL & getServer(size_t target) { return target ? *replicas[target - 1] : *primary; }
+    MySQLReplicaLoad & getLoad() { return *load; }
+    // Called after a write has been executed on the primary
+    void onWrite();
+
+  private:
+    void recordWrite();
+
+    std::shared_ptr<MySQL> primary;
+    std::vector<std::shared_ptr<MySQL> > replicas;
+    MySQLRouterOptions options;
+    std::shared_ptr<MySQLReplicaLoad> load;
+    bool in_transaction = false, has_transaction_writes = false, has_written = false;
+    size_t next_replica = 0;
+    std::chrono::steady_clock::time_point last_write;
+    std::string last_gtid;
+    // last GTID each replica is known to have applied
+    std::vector<std::string> replica_gtid;
+  };
+
+  class MySQLRoutedStatement : public SQLStatement {
+  public:
+    MySQLRoutedStatement(MySQLRouter & _router, const std::string & query);
+    ~MySQLRoutedStatement();
+
+    unsigned int execute() override;
+    bool next() override;
+    void reset() override;
+    void setTimeout(std::chrono::milliseconds _timeout) override;
+    void cancel() override;
+
+    MySQLRoutedStatement & bind(bool value, bool is_defined = true) override { return store(value, is_defined); }
+    MySQLRoutedStatement & bind(const std::string & value, bool is_defined = true) override { return store(value, is_defined); }
+    MySQLRoutedStatement & bind(double value, bool is_defined = true) override { return store(value, is_defined); }
+    MySQLRoutedStatement & bind(const ustring & value, bool is_defined = true) override { return store(value, is_defined); }
+    MySQLRoutedStatement & bind(int value, bool is_defined = true) override { return store(value, is_defined); }
+    MySQLRoutedStatement & bind(const char * value, bool is_defined = true) override { return store(std::string(value ? value : ""), is_defined); }
+    MySQLRoutedStatement & bind(unsigned int value, bool is_defined = true) override { return store(value, is_defined); }
+    MySQLRoutedStatement & bind(const void * data, size_t len, bool is_defined = true) override { return store(ustring((const unsigned char *)data, len), is_defined); }
+    MySQLRoutedStatement & bind(long long value, bool is_defined = true) override { return store(value, is_defined); }
+    MySQLRoutedStatement & bindStream(std::istream & input, size_t len, bool is_defined = true) override;
+
+    double getDouble(int column_index) override { return getTarget().getDouble(column_index); }
+    long long getLongLong(int column_index) override { return getTarget().getLongLong(column_index); }
+    using SQLStatement::getText;
+    using SQLStatement::getBlob;
+    ustring getBlob(int column_index) override { return getTarget().getBlob(column_index); }
+    int getInt(int column_index) override { return getTarget().getInt(column_index); }
+    bool getBool(int column_index) override { return getTarget().getBool(column_index); }
+    std::string getText(int column_index) override { return getTarget().getText(column_index); }
+    unsigned int getUInt(int column_index) override { return getTarget().getUInt(column_index); }
+    size_t getBlobSize(int column_index) override { return getTarget().getBlobSize(column_index); }
+    size_t readBlob(int column_index, size_t offset, void * buffer, size_t len) override { return getTarget().readBlob(column_index, offset, buffer, len); }
+    void fetchRow(const field_s * fields, unsigned int num_fields) override { getTarget().fetchRow(fields, num_fields); }
+
+    bool isNull(int column_index) override { return getTarget().isNull(column_index); }
+    long long getLastInsertId() const override { return target ? target->getLastInsertId() : 0; }
+    unsigned int getAffectedRows() const override { return target ? target->getAffectedRows() : 0; }
+    unsigned int getNumFields() override { return (unsigned int)columns.size(); }
+
+    // Server of the last execution: 0 for the primary or 1 + replica index
+    size_t getTargetIndex() const { return target_index; }
+
+  private:
+    template <class T>
+    MySQLRoutedStatement & store(T value, bool is_defined) {
+      unsigned int index = getNextBindIndex();
+      if (binds.size() < index) binds.resize(index);
+      binds[index - 1] = [value, is_defined](SQLStatement & stmt) { stmt.bind(value, is_defined); };
+      return *this;
+    }
+
+    SQLStatement & getStatement(size_t index);
+    SQLStatement & getTarget();
+    unsigned int start();
+    void release();
+
+    MySQLRouter & router;
+    bool is_read;
+    // statements are prepared on each server when first routed there
+    std::vector<std::shared_ptr<SQLStatement> > stmts;
+    std::vector<std::function<void (SQLStatement &)> > binds;
+    SQLStatement * target = 0;
+    size_t target_index = 0;
+    bool is_executed = false, is_outstanding = false; // counted in the replica load
+  };
+};
+
+#endif
@@ -2,61 +2,154 @@
 #define _SQLDB_ODBC_H_
 
 #include "Connection.h"
+#include "SQLStatement.h"
 
-#include <windows.h>
 #include <sql.h>
+#include <sqlext.h>
 #include <vector>
 
+#define ODBC_MAX_BATCH_SIZE 4096
+#define ODBC_ROW_ARRAY_SIZE 256
+#define ODBC_MAX_BOUND_COLUMN_SIZE 8192
+
 namespace sqldb {
   class ODBC : public Connection {
   public:
-    ODBCInterface(const std::string & _dsn, const std::string & _username, const std::string & _password);
-    ~ODBCInterface();
+    // dsn is either a data source name or a full connection string
+    // such as "Driver=SQLite3;Database=/tmp/test.db"
+    ODBC(const std::string & _dsn, const std::string & _username = "", const std::string & _password = "");
+    ~ODBC();
 
     bool connect();
-	
-    std::shared_ptr<SQLStatement> prepare(const string & query);
-      
+    bool disconnect();
+
+    std::shared_ptr<SQLStatement> prepare(const std::string & query) override;
+    bool ping() override;
+    void begin() override;
     void commit() override;
     void rollback() override;
 
-    bool disconnect();
-    
+    unsigned int execute(const char * query) override;
+
+    const std::string & getErrorString() const { return error_string; }
+
   private:
-    struct query_data {
-      SQLINTEGER size;
-      unsigned char * ptr;
-    };
-  
-    string createErrorString(SQLSMALLINT handle_type, SQLHANDLE handle);
-        
-    string dsn, username, password;
-    string error_string;
-    
-    HENV env = 0; // environment handle
-    HDBC dbc = 0; // connection handle
-
-    SQLINTEGER nts;
+    std::string dsn, username, password;
+    std::string error_string;
+
+    SQLHENV env = 0; // environment handle
+    SQLHDBC dbc = 0; // connection handle
+    SQLUINTEGER getdata_extensions = 0; // SQL_GD_* flags of the driver
   };
 
   class ODBCStatement : public SQLStatement {
   public:
-    ODBCStatement() { }
+    ODBCStatement(SQLHSTMT _stmt, const std::string & _query, const std::vector<std::string> & parameter_names = std::vector<std::string>());
+    ~ODBCStatement();
+
+    unsigned int execute() override;
+    // SQLCancel() may be called from another thread
+    void cancel() override { SQLCancel(stmt); }
+    bool next() override;
+    void reset() override;
+
+    void addBatch() override;
+    unsigned int executeBatch() override;
+
+    ODBCStatement & bind(int value, bool is_defined = true) override;
+    ODBCStatement & bind(long long value, bool is_defined = true) override;
+    ODBCStatement & bind(const ustring & value, bool is_defined = true) override;
+    ODBCStatement & bind(const char * value, bool is_defined = true) override;
+    ODBCStatement & bind(bool value, bool is_defined = true) override;
+    ODBCStatement & bind(unsigned int value, bool is_defined = true) override;
+    ODBCStatement & bind(const std::string & value, bool is_defined = true) override;
+    ODBCStatement & bind(const void * data, size_t len, bool is_defined = true) override;
+    ODBCStatement & bind(double value, bool is_defined = true) override;
+    ODBCStatement & bindStream(std::istream & input, size_t len, bool is_defined = true) override;
 
-    bool bind(double value);
-    bool bind(unsigned int value);
-    bool bind(int value);
-    bool bind(time_t value);
-    bool bind(const string & str);
-    bool bind(const char * str);
-    unsigned int getAffectedRows() override;
+    int getInt(int column_index) override;
+    unsigned int getUInt(int column_index) override;
+    double getDouble(int column_index) override;
+    long long getLongLong(int column_index) override;
+    bool getBool(int column_index) override;
+    using SQLStatement::getText;
+    using SQLStatement::getBlob;
+    std::string getText(int column_index) override;
+    ustring getBlob(int column_index) override;
+
+    size_t getBlobSize(int column_index) override;
+    size_t readBlob(int column_index, size_t offset, void * buffer, size_t len) override;
+
+    bool isNull(int column_index) override;
+
+    // ODBC has no portable way to get the last insert id
+    long long getLastInsertId() const override { return 0; }
+    unsigned int getAffectedRows() const override { return rows_affected; }
+    unsigned int getNumFields() override { return num_result_columns; }
+
+    // Number of parameter rows sent with a single SQLExecute
+    void setMaxBatchSize(size_t n) { max_batch_size = n ? n : 1; }
+    // Number of rows fetched with a single SQLFetch when a block cursor is used
+    void setRowArraySize(size_t n) { row_array_size = n ? n : 1; }
+    // SQL_GETDATA_EXTENSIONS of the driver
+    void setGetDataExtensions(SQLUINTEGER extensions) { getdata_extensions = extensions; }
+
+  protected:
+    void executeRows(size_t num_rows);
+    void flushBatch();
+    SQLRETURN sendLongData();
+    void describeColumns();
+    void bindColumns();
+    void positionCursor();
+    const char * getBoundData(int column_index, SQLSMALLINT & c_type, SQLLEN & len);
+    bool getData(int column_index, SQLSMALLINT c_type, void * buffer, SQLLEN len, SQLLEN * indicator);
+    ODBCStatement & bindData(SQLSMALLINT c_type, SQLSMALLINT sql_type, const void * ptr, size_t size, bool is_defined);
 
   private:
-    void clearBoundData();
-    query_data & bindData(const void * ptr, size_t size);
-    vector<query_data> bound_data;
+    // Column-wise parameter array: one element of width bytes per batch row
+    struct query_data {
+      SQLSMALLINT c_type = 0, sql_type = 0;
+      SQLLEN width = 0;
+      std::vector<char> buffer;
+      std::vector<SQLLEN> length;
+      std::istream * input = 0;
+      size_t input_len = 0;
+      const void * bound_ptr = 0;
+      const SQLLEN * bound_length = 0;
+      SQLLEN bound_width = 0;
+    };
+
+    // Column-wise result buffers for a block cursor
+    struct column_data {
+      SQLSMALLINT sql_type = 0, c_type = 0;
+      SQLLEN width = 0;
+      bool is_bound = false;
+      std::vector<char> buffer;
+      std::vector<SQLLEN> length;
+    };
+
+    // Value of a column in the current row without a block cursor
+    struct cached_value_s {
+      bool is_fetched = false, is_null = true;
+      SQLSMALLINT c_type = 0;
+      std::string data;
+    };
+    const cached_value_s & getCachedValue(int column_index);
 
-    HSTMT stmt = 0; // statement handle
+    SQLHSTMT stmt = 0; // statement handle
+    SQLULEN applied_timeout = 0; // seconds
+    std::vector<query_data> bound_data;
+    std::vector<column_data> column_buffers;
+    std::vector<cached_value_s> row_cache;
+    size_t row_array_size = ODBC_ROW_ARRAY_SIZE, current_row = 0;
+    SQLULEN rows_fetched = 0;
+    SQLUINTEGER getdata_extensions = 0;
+    bool is_block_cursor = false, is_positioned = false;
+    size_t batch_rows = 0, max_batch_size = ODBC_MAX_BATCH_SIZE;
+    bool has_result_set = false, is_query_executed = false;
+    unsigned int rows_affected = 0, num_result_columns = 0;
+    int data_column = -1;
+    size_t data_offset = 0;
   };
 };
 
@@ -0,0 +1,103 @@
+#ifndef _SQLDB_PREFETCHINGSTATEMENT_H_
+#define _SQLDB_PREFETCHINGSTATEMENT_H_
+
+#include "SQLStatement.h"
+#include "ResultSet.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sqldb {
+  struct PrefetchOptions {
+    size_t batch_size = 256; // rows copied per batch
+    size_t depth = 2;        // batches queued ahead of the reader
+  };
+
+  // Reads the rows of a statement on a background thread so that fetching
+  // overlaps with processing. The thread copies batches of rows into a
+  // bounded single-producer single-consumer ring of ResultSets, and next()
+  // reads from the oldest batch. The wrapped statement must not be used
+  // directly while rows are being read.
+  class PrefetchingStatement : public SQLStatement {
+  public:
+    PrefetchingStatement(std::shared_ptr<SQLStatement> _stmt, const PrefetchOptions & _options = PrefetchOptions());
+    ~PrefetchingStatement();
+
+    unsigned int execute() override;
+    // Starts the reader thread on the first call
+    bool next() override;
+    void reset() override;
+    void setTimeout(std::chrono::milliseconds _timeout) override { SQLStatement::setTimeout(_timeout); stmt->setTimeout(_timeout); }
+    void cancel() override { stmt->cancel(); }
+
+    PrefetchingStatement & bind(bool value, bool is_defined = true) override { return forward(value, is_defined); }
+    PrefetchingStatement & bind(const std::string & value, bool is_defined = true) override { return forward(value, is_defined); }
+    PrefetchingStatement & bind(double value, bool is_defined = true) override { return forward(value, is_defined); }
+    PrefetchingStatement & bind(const ustring & value, bool is_defined = true) override { return forward(value, is_defined); }
+    PrefetchingStatement & bind(int value, bool is_defined = true) override { return forward(value, is_defined); }
+    PrefetchingStatement & bind(const char * value, bool is_defined = true) override { return forward(value, is_defined); }
+    PrefetchingStatement & bind(unsigned int value, bool is_defined = true) override { return forward(value, is_defined); }
+    PrefetchingStatement & bind(const void * data, size_t len, bool is_defined = true) override;
+    PrefetchingStatement & bind(long long value, bool is_defined = true) override { return forward(value, is_defined); }
+    PrefetchingStatement & bindStream(std::istream & input, size_t len, bool is_defined = true) override;
+
+    double getDouble(int column_index) override { return getResult().getDouble(row, column_index); }
+    long long getLongLong(int column_index) override { return getResult().getLongLong(row, column_index); }
+    using SQLStatement::getText;
+    using SQLStatement::getBlob;
+    ustring getBlob(int column_index) override { return getResult().getBlob(row, column_index); }
+    int getInt(int column_index) override { return getResult().getInt(row, column_index); }
+    bool getBool(int column_index) override { return getResult().getBool(row, column_index); }
+    std::string getText(int column_index) override { return getResult().getText(row, column_index); }
+    unsigned int getUInt(int column_index) override { return getResult().getUInt(row, column_index); }
+    size_t getBlobSize(int column_index) override;
+    size_t readBlob(int column_index, size_t offset, void * buffer, size_t len) override;
+
+    bool isNull(int column_index) override { return getResult().isNull(row, column_index); }
+    long long getLastInsertId() const override { return stmt->getLastInsertId(); }
+    unsigned int getAffectedRows() const override { return stmt->getAffectedRows(); }
+    unsigned int getNumFields() override { return (unsigned int)columns.size(); }
+
+  private:
+    template <class T>
+    PrefetchingStatement & forward(T value, bool is_defined) {
+      stop();
+      stmt->setBindIndex(getNextBindIndex());
+      stmt->bind(value, is_defined);
+      return *this;
+    }
+
+    void run();
+    void stop();
+    template <class F> void waitFor(F is_ready);
+    void wake();
+    const ResultSet & getResult() const;
+
+    std::shared_ptr<SQLStatement> stmt;
+    PrefetchOptions options;
+    std::thread thread;
+    bool is_started = false;
+
+    // ring of depth batches: the reader thread only advances tail and
+    // next() only advances head
+    std::vector<std::shared_ptr<const ResultSet> > ring;
+    std::atomic<size_t> head{0}, tail{0};
+    std::atomic<bool> is_finished{false}, is_stopping{false};
+    std::exception_ptr error; // set by the reader thread before is_finished
+
+    // the side that finds the ring empty or full spins briefly and then sleeps
+    std::mutex wait_mutex;
+    std::condition_variable wait_cond;
+    std::atomic<unsigned int> num_waiting{0};
+
+    std::shared_ptr<const ResultSet> current;
+    size_t row = 0;
+  };
+};
+
+#endif
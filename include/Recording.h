@@ -0,0 +1,93 @@
+#ifndef _SQLDB_RECORDING_H_
+#define _SQLDB_RECORDING_H_
+
+#include "Connection.h"
+#include "SQLStatement.h"
+#include "WorkloadLog.h"
+
+namespace sqldb {
+  // Connection decorator that records prepares, executes with their bound
+  // values, fetched row counts, transactions and timings into a WorkloadLog
+  class RecordingConnection : public Connection {
+  public:
+    RecordingConnection(std::shared_ptr<Connection> _conn, std::shared_ptr<WorkloadLog> _log);
+
+    std::shared_ptr<SQLStatement> prepare(const std::string & query) override;
+    void begin() override;
+    void commit() override;
+    void rollback() override;
+    unsigned int execute(const char * query) override;
+    bool ping() override { return conn->ping(); }
+    void cancel() override { conn->cancel(); }
+
+    Connection & getConnection() { return *conn; }
+
+  private:
+    void record(WorkloadRecord::Type type, unsigned long long started, const char * query = 0);
+
+    std::shared_ptr<Connection> conn;
+    std::shared_ptr<WorkloadLog> log;
+    unsigned int session;
+  };
+
+  class RecordingStatement : public SQLStatement {
+  public:
+    RecordingStatement(std::shared_ptr<SQLStatement> _stmt, std::shared_ptr<WorkloadLog> _log, unsigned int _session, unsigned long long _statement_id);
+    ~RecordingStatement();
+
+    unsigned int execute() override;
+    bool next() override;
+    void reset() override;
+    SQLStatus<unsigned int> tryExecute() override;
+    SQLStatus<bool> tryNext() override;
+    void addBatch() override;
+    unsigned int executeBatch() override;
+    void setTimeout(std::chrono::milliseconds _timeout) override { SQLStatement::setTimeout(_timeout); stmt->setTimeout(_timeout); }
+    void cancel() override { stmt->cancel(); }
+
+    RecordingStatement & bind(bool value, bool is_defined = true) override;
+    RecordingStatement & bind(const std::string & value, bool is_defined = true) override;
+    RecordingStatement & bind(double value, bool is_defined = true) override;
+    RecordingStatement & bind(const ustring & value, bool is_defined = true) override;
+    RecordingStatement & bind(int value, bool is_defined = true) override;
+    RecordingStatement & bind(const char * value, bool is_defined = true) override;
+    RecordingStatement & bind(unsigned int value, bool is_defined = true) override;
+    RecordingStatement & bind(const void * data, size_t len, bool is_defined = true) override;
+    RecordingStatement & bind(long long value, bool is_defined = true) override;
+    RecordingStatement & bindStream(std::istream & input, size_t len, bool is_defined = true) override;
+
+    double getDouble(int column_index) override { return stmt->getDouble(column_index); }
+    long long getLongLong(int column_index) override { return stmt->getLongLong(column_index); }
+    using SQLStatement::getText;
+    using SQLStatement::getBlob;
+    ustring getBlob(int column_index) override { return stmt->getBlob(column_index); }
+    int getInt(int column_index) override { return stmt->getInt(column_index); }
+    bool getBool(int column_index) override { return stmt->getBool(column_index); }
+    std::string getText(int column_index) override { return stmt->getText(column_index); }
+    unsigned int getUInt(int column_index) override { return stmt->getUInt(column_index); }
+    size_t getBlobSize(int column_index) override { return stmt->getBlobSize(column_index); }
+    size_t readBlob(int column_index, size_t offset, void * buffer, size_t len) override { return stmt->readBlob(column_index, offset, buffer, len); }
+    void fetchRow(const field_s * fields, unsigned int num_fields) override { stmt->fetchRow(fields, num_fields); }
+
+    ColumnType getColumnType(int column_index) override { return stmt->getColumnType(column_index); }
+    bool isNull(int column_index) override { return stmt->isNull(column_index); }
+    long long getLastInsertId() const override { return stmt->getLastInsertId(); }
+    unsigned int getAffectedRows() const override { return stmt->getAffectedRows(); }
+    unsigned int getNumFields() override { return stmt->getNumFields(); }
+
+  private:
+    WorkloadParameter & getParameter();
+    void record(WorkloadRecord::Type type, unsigned long long started, unsigned long long rows, bool with_parameters = false);
+    void recordRows();
+
+    std::shared_ptr<SQLStatement> stmt;
+    std::shared_ptr<WorkloadLog> log;
+    unsigned int session;
+    unsigned long long statement_id;
+    std::vector<WorkloadParameter> parameters;
+    bool is_query_executed = false;
+    unsigned long long num_rows = 0, fetch_started = 0;
+  };
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef _SQLDB_RESULTSET_H_
+#define _SQLDB_RESULTSET_H_
+
+#include "SQLStatement.h"
+
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sqldb {
+  // Immutable copy of a result. Rows are fixed-width arrays of cells and
+  // text and blob values are stored in a single contiguous block, so a
+  // ResultSet can be read by many threads at once after the statement and
+  // its connection have been released.
+  class ResultSet {
+  public:
+    class Row {
+    public:
+      Row(const ResultSet & _rs, size_t _row) : rs(&_rs), row(_row) { }
+
+      bool isNull(int column_index) const { return rs->isNull(row, column_index); }
+      int getInt(int column_index) const { return rs->getInt(row, column_index); }
+      unsigned int getUInt(int column_index) const { return rs->getUInt(row, column_index); }
+      long long getLongLong(int column_index) const { return rs->getLongLong(row, column_index); }
+      double getDouble(int column_index) const { return rs->getDouble(row, column_index); }
+      bool getBool(int column_index) const { return rs->getBool(row, column_index); }
+      std::string getText(int column_index) const { return rs->getText(row, column_index); }
+      std::string_view getTextView(int column_index) const { return rs->getTextView(row, column_index); }
+      ustring getBlob(int column_index) const { return rs->getBlob(row, column_index); }
+
+      size_t getIndex() const { return row; }
+
+    private:
+      const ResultSet * rs;
+      size_t row;
+    };
+
+    class const_iterator {
+    public:
+      const_iterator(const ResultSet & _rs, size_t _row) : rs(&_rs), row(_row) { }
+
+      Row operator*() const { return Row(*rs, row); }
+      const_iterator & operator++() { row++; return *this; }
+      bool operator==(const const_iterator & other) const { return row == other.row; }
+      bool operator!=(const const_iterator & other) const { return row != other.row; }
+
+    private:
+      const ResultSet * rs;
+      size_t row;
+    };
+
+    // Copies up to max_rows rows (all if zero) from the statement. Cells and
+    // data are allocated from resource, or the default resource if null.
+    ResultSet(SQLStatement & stmt, size_t max_rows = 0, std::pmr::memory_resource * resource = 0);
+    // Keeps the resource alive until the result is destroyed
+    ResultSet(SQLStatement & stmt, size_t max_rows, std::shared_ptr<std::pmr::memory_resource> resource)
+      : ResultSet(stmt, max_rows, resource.get()) { owned_resource = resource; }
+
+    size_t size() const { return num_rows; }
+    bool empty() const { return num_rows == 0; }
+    unsigned int getNumFields() const { return num_columns; }
+    const std::string & getColumnName(int column_index) const;
+    SQLStatement::ColumnType getColumnType(int column_index) const;
+
+    bool isNull(size_t row, int column_index) const { return getCell(row, column_index).type == CELL_NULL; }
+    int getInt(size_t row, int column_index) const { return (int)getLongLong(row, column_index); }
+    unsigned int getUInt(size_t row, int column_index) const { return (unsigned int)getLongLong(row, column_index); }
+    long long getLongLong(size_t row, int column_index) const;
+    double getDouble(size_t row, int column_index) const;
+    bool getBool(size_t row, int column_index) const { return getLongLong(row, column_index) != 0; }
+    std::string getText(size_t row, int column_index) const;
+    std::string_view getTextView(size_t row, int column_index) const;
+    ustring getBlob(size_t row, int column_index) const;
+
+    // Compares a value with a value in another result using SQLite's ordering:
+    // NULL < numbers < text < blob. Text and blobs are compared bytewise.
+    int compare(size_t row, int column_index, const ResultSet & other, size_t other_row, int other_column_index) const;
+
+    Row operator[](size_t row) const { return Row(*this, row); }
+    const_iterator begin() const { return const_iterator(*this, 0); }
+    const_iterator end() const { return const_iterator(*this, num_rows); }
+
+    // Bytes used by cells and variable length data
+    size_t getMemoryUsage() const { return cells.capacity() * sizeof(cell_s) + data.capacity(); }
+
+  private:
+    enum cell_type { CELL_NULL = 0, CELL_INT, CELL_DOUBLE, CELL_TEXT, CELL_BLOB };
+
+    struct cell_s {
+      union {
+	long long int_value;
+	double double_value;
+	size_t offset;
+      };
+      uint32_t len;
+      uint8_t type;
+    };
+
+    void readColumns(SQLStatement & stmt);
+
+    const cell_s & getCell(size_t row, int column_index) const {
+      if (row >= num_rows) {
+	throw SQLException(SQLException::GET_FAILED, "Row index out of range");
+      }
+      if (column_index < 0 || column_index >= (int)num_columns) {
+	throw SQLException(SQLException::BAD_COLUMN_INDEX);
+      }
+      return cells[row * num_columns + column_index];
+    }
+
+    // declared before the cells so that it is destroyed after them
+    std::shared_ptr<std::pmr::memory_resource> owned_resource;
+    size_t num_rows = 0;
+    unsigned int num_columns = 0;
+    std::vector<std::string> column_names;
+    std::vector<SQLStatement::ColumnType> column_types;
+    std::pmr::vector<cell_s> cells;
+    std::pmr::vector<char> data;
+  };
+};
+
+#endif
@@ -20,7 +20,12 @@ namespace sqldb {
       GET_FAILED,
       COMMIT_FAILED,
       ROLLBACK_FAILED,
-      CONSTRAINT_VIOLATION
+      CONSTRAINT_VIOLATION,
+      DEADLOCK,
+      LOCK_WAIT_TIMEOUT,
+      DATABASE_BUSY,
+      RESOURCE_LIMIT,
+      QUERY_CANCELLED
     };
   SQLException(ErrorType _type) : type(_type) { }
   SQLException(ErrorType _type, const std::string & _errormsg)
@@ -31,6 +36,9 @@ namespace sqldb {
     ErrorType getType() const { return type; }
     const std::string & getErrorMsg() const { return errormsg; }
     const std::string & getQuery() const { return query; }
+
+    // True for conflicts that can succeed if the transaction is run again
+    bool isRetryable() const { return type == DEADLOCK || type == LOCK_WAIT_TIMEOUT || type == DATABASE_BUSY; }
     
     const char * what() const throw() {
       switch (type) {
@@ -47,6 +55,11 @@ namespace sqldb {
       case COMMIT_FAILED: return "Commit failed";
       case ROLLBACK_FAILED: return "Rollback failed";
       case CONSTRAINT_VIOLATION: return "Constraint violation";
+      case DEADLOCK: return "Deadlock";
+      case LOCK_WAIT_TIMEOUT: return "Lock wait timeout";
+      case DATABASE_BUSY: return "Database busy";
+      case RESOURCE_LIMIT: return "Resource limit exceeded";
+      case QUERY_CANCELLED: return "Query cancelled";
       }
       return "Unknown error";
     }
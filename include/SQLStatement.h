@@ -2,11 +2,35 @@
 #define _SQLDB_SQLSTATEMENT_H_
 
 #include "ustring.h"
+#include "SQLException.h"
+#include "SQLStatus.h"
+#include "StructMapping.h"
+#include "MemoryTracker.h"
+
+#include <chrono>
 #include <string>
+#include <istream>
+#include <ostream>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
 
 namespace sqldb {
+  class ResultSet;
+  
   class SQLStatement {
   public:
+    enum ColumnType {
+      ANY = 0,
+      INT,
+      INT64,
+      DOUBLE,
+      TEXT,
+      BLOB,
+      DATETIME
+    };
+
     SQLStatement() { }
   SQLStatement(const std::string & _query) : query(_query) { }
 
@@ -14,10 +38,36 @@ namespace sqldb {
 
     virtual unsigned int execute() = 0;
     virtual bool next() = 0;
+
+    // Non-throwing variants for hot loops: failures such as constraint
+    // violations are returned as an error type without building strings
+    virtual SQLStatus<unsigned int> tryExecute();
+    virtual SQLStatus<bool> tryNext();
     virtual void reset() {
       next_bind_index = 1;
     }
 
+    // Time limit for each execution, zero for none. Exceeding it fails the
+    // statement with QUERY_TIMED_OUT. SQLite also counts the steps that
+    // fetch rows.
+    virtual void setTimeout(std::chrono::milliseconds _timeout) { timeout = _timeout; }
+    std::chrono::milliseconds getTimeout() const { return timeout; }
+    // Stops the running execution from another thread with QUERY_CANCELLED.
+    // The statement can be reset and executed again.
+    virtual void cancel() { }
+
+    // Queues the bound parameters as one row of a batch that is sent by
+    // executeBatch(). Backends without parameter arrays execute each row here.
+    virtual void addBatch() {
+      batch_affected_rows += execute();
+      reset();
+    }
+    virtual unsigned int executeBatch() {
+      unsigned int r = batch_affected_rows;
+      batch_affected_rows = 0;
+      return r;
+    }
+
     virtual SQLStatement & bind(bool value, bool is_defined = true) = 0;
     virtual SQLStatement & bind(const std::string & value, bool is_defined = true) = 0;
     virtual SQLStatement & bind(double value, bool is_defined = true) = 0;
@@ -28,6 +78,43 @@ namespace sqldb {
     virtual SQLStatement & bind(const void * data, size_t len, bool is_defined = true) = 0;
     virtual SQLStatement & bind(long long value, bool is_defined = true) = 0;
 
+    // Binds a large value that is read from input in chunks during execute()
+    virtual SQLStatement & bindStream(std::istream & input, size_t len, bool is_defined = true) = 0;
+
+    // Binds value to every placeholder with the given name, e.g. ":id". On hot
+    // paths resolve the name once with getParameterIndex() and use setBindIndex().
+    template <class T>
+    SQLStatement & bindNamed(const std::string & name, const T & value, bool is_defined = true) {
+      auto it = named_parameters.find(name);
+      if (it == named_parameters.end()) {
+	throw SQLException(SQLException::BAD_BIND_INDEX, name, getQuery());
+      }
+      for (unsigned int index : it->second) {
+	next_bind_index = index;
+	bind(value, is_defined);
+      }
+      return *this;
+    }
+
+    // Returns the first 1-based bind index of a named parameter, or 0 if there is none
+    unsigned int getParameterIndex(const std::string & name) const {
+      auto it = named_parameters.find(name);
+      return it != named_parameters.end() ? it->second.front() : 0;
+    }
+    SQLStatement & setBindIndex(unsigned int index) {
+      next_bind_index = index;
+      return *this;
+    }
+
+    // Replaces :name placeholders with ? for backends that only support
+    // positional parameters
+    static std::string rewriteNamedParameters(const std::string & query, std::vector<std::string> & names);
+
+    // True for a SELECT, or a WITH query whose main statement is a SELECT,
+    // that writes nothing (SELECT ... INTO is excluded). Comments, quoted
+    // text and parentheses are skipped.
+    static bool isSelect(const std::string & query);
+
     virtual double getDouble(int column_index) = 0;
     virtual long long getLongLong(int column_index) = 0;
     virtual ustring getBlob(int column_index) = 0;
@@ -36,6 +123,83 @@ namespace sqldb {
     virtual std::string getText(int column_index) = 0;
     virtual unsigned int getUInt(int column_index) = 0;
 
+    // Incremental access to large values in the current row. readBlob()
+    // avoids a full-size copy of the value, but the value may already be in
+    // client memory in full: MySQL has received the whole row when next()
+    // returns and mysql_stmt_fetch_column() only copies out of it, and SQLite
+    // loads a value on first access. Peak memory is therefore not bounded by
+    // the chunk size. SQLite::openBlob() reads a stored value page by page.
+    virtual size_t getBlobSize(int column_index) = 0;
+    virtual size_t readBlob(int column_index, size_t offset, void * buffer, size_t len) = 0;
+
+    size_t streamBlob(int column_index, std::ostream & output, size_t chunk_size = 0x10000);
+
+    // Allocates returned values and temporary buffers from the given resource,
+    // e.g. a per-request std::pmr::monotonic_buffer_resource. Temporary buffers
+    // are released when the statement has executed or is reset, after which
+    // the resource only has to outlive the values allocated from it.
+    void setMemoryResource(std::pmr::memory_resource * _memory_resource) { memory_resource = _memory_resource; }
+    std::pmr::memory_resource * getMemoryResource() const {
+      return memory_resource ? memory_resource : std::pmr::get_default_resource();
+    }
+
+    // Counts the statement's buffers, bind copies and results. Set by the
+    // connection when it has memory limits.
+    void setMemoryTracker(std::shared_ptr<MemoryTracker> _memory_tracker) { memory_tracker = _memory_tracker; }
+    MemoryTracker * getMemoryTracker() const { return memory_tracker.get(); }
+
+    // Variants of getText() and getBlob() that allocate from a resource
+    // (the statement's resource if null)
+    std::pmr::string getText(int column_index, std::pmr::memory_resource * resource);
+    pmr_ustring getBlob(int column_index, std::pmr::memory_resource * resource);
+
+    // Binds the members of a mapped struct (see StructMapping.h) to the next
+    // parameters and fetches rows into mapped structs with one virtual call per row
+    template <class T>
+    SQLStatement & bindStruct(const T & obj) {
+      field_s fields[StructMapping<T>::size];
+      StructMapping<T>::getFields(const_cast<T &>(obj), fields);
+      bindRow(fields, StructMapping<T>::size);
+      return *this;
+    }
+    template <class T>
+    bool fetchInto(T & obj) {
+      if (!next()) return false;
+      field_s fields[StructMapping<T>::size];
+      StructMapping<T>::getFields(obj, fields);
+      fetchRow(fields, StructMapping<T>::size);
+      return true;
+    }
+    // Appends up to max_rows rows (all if zero) and returns the number of rows read
+    template <class T>
+    size_t fetchInto(std::vector<T> & rows, size_t max_rows = 0) {
+      field_s fields[StructMapping<T>::size];
+      size_t n = 0;
+      while ((!max_rows || n < max_rows) && next()) {
+	rows.emplace_back();
+	StructMapping<T>::getFields(rows.back(), fields);
+	fetchRow(fields, StructMapping<T>::size);
+	n++;
+      }
+      return n;
+    }
+
+    // Stores the first num_fields columns of the current row into the fields
+    virtual void fetchRow(const field_s * fields, unsigned int num_fields);
+    virtual void bindRow(const field_s * fields, unsigned int num_fields);
+
+    // Copies the remaining rows (at most max_rows if non-zero) into an immutable
+    // ResultSet allocated from resource (the memory tracker or the statement's
+    // resource if null)
+    std::shared_ptr<const ResultSet> fetchAll(size_t max_rows = 0, std::pmr::memory_resource * resource = 0);
+
+    // Column metadata is read once per prepare. getColumnType() returns the
+    // declared type, or ANY if it is not known.
+    virtual ColumnType getColumnType(int column_index) { return getColumnInfo(column_index).type; }
+    virtual bool isNull(int column_index) = 0;
+    const std::string & getColumnName(int column_index) const { return getColumnInfo(column_index).name; }
+    size_t getColumnSize(int column_index) const { return getColumnInfo(column_index).size; }
+
     virtual long long getLastInsertId() const = 0;
     virtual unsigned int getAffectedRows() const = 0;
     virtual unsigned int getNumFields() = 0;
@@ -44,13 +208,37 @@ namespace sqldb {
     const std::string & getQuery() const { return query; }
 
   protected:
+    struct column_info {
+      std::string name;
+      ColumnType type = ANY;
+      size_t size = 0;
+    };
+
     unsigned int getNextBindIndex() { return next_bind_index++; }
+    // Resource for internal buffers that are released with the statement
+    std::pmr::memory_resource * getBufferResource() const {
+      return memory_tracker ? memory_tracker.get() : getMemoryResource();
+    }
+    template <class T> void readValue(int column_index, T & s);
+    void addNamedParameter(const std::string & name, unsigned int index);
+    const column_info & getColumnInfo(int column_index) const {
+      if (column_index < 0 || column_index >= (int)columns.size()) {
+	throw SQLException(SQLException::BAD_COLUMN_INDEX, "", getQuery());
+      }
+      return columns[column_index];
+    }
     
     bool results_available = false;
+    unsigned int batch_affected_rows = 0;
+    std::vector<column_info> columns;
 
   private:
     std::string query;
     unsigned int next_bind_index = 1;
+    std::unordered_map<std::string, std::vector<unsigned int> > named_parameters;
+    std::pmr::memory_resource * memory_resource = 0;
+    std::shared_ptr<MemoryTracker> memory_tracker;
+    std::chrono::milliseconds timeout{0};
   };
 };
 
@@ -0,0 +1,27 @@
+#ifndef _SQLDB_SQLSTATUS_H_
+#define _SQLDB_SQLSTATUS_H_
+
+#include "SQLException.h"
+
+namespace sqldb {
+  // Result of a non-throwing call: either a value or the type of the error.
+  // No allocations are made for either case.
+  template <class T>
+  class SQLStatus {
+  public:
+    SQLStatus(T _value) : value(_value) { }
+    SQLStatus(SQLException::ErrorType _error) : error(_error) { }
+
+    bool ok() const { return error == 0; }
+    explicit operator bool() const { return error == 0; }
+    
+    const T & getValue() const { return value; }
+    SQLException::ErrorType getError() const { return (SQLException::ErrorType)error; }
+
+  private:
+    T value = T();
+    int error = 0;
+  };
+};
+
+#endif
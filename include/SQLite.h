@@ -3,32 +3,162 @@
 
 #include "Connection.h"
 #include "SQLStatement.h"
+#include "SQLiteFunction.h"
+#include "SQLiteVirtualTable.h"
 
 #include <sqlite3.h>
 
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
 namespace sqldb {
+  class SQLiteBlob;
+
+  // Row of EXPLAIN QUERY PLAN. Steps form a tree through parent.
+  struct SQLitePlanStep {
+    int id;
+    int parent;
+    std::string detail;
+  };
+
+  // Counters from sqlite3_stmt_status(), cumulative since preparation or
+  // the last reset
+  struct SQLiteStatementStatus {
+    int fullscan_steps = 0; // forward steps of full table scans
+    int sorts = 0;          // sorts without an index
+    int autoindexes = 0;    // rows inserted into automatic indexes
+    int vm_steps = 0;       // virtual machine operations
+    int reprepares = 0;     // recompilations after schema changes
+    int runs = 0;           // completed executions
+    int memused = 0;        // bytes used by the statement
+  };
+  
   class SQLite : public Connection {
   public:
     SQLite(const std::string & _db_file, bool read_only = false);
     ~SQLite();
   
     std::shared_ptr<sqldb::SQLStatement> prepare(const std::string & query) override;
+    // Interrupts every statement running on the connection. Until all of
+    // them have been reset, new statements on the connection fail as well.
+    void cancel() override { if (db) sqlite3_interrupt(db); }
+
+    const std::string & getDatabaseFile() const { return db_file; }
+
+    // Runs a WAL checkpoint with SQLITE_CHECKPOINT_PASSIVE, FULL, RESTART or
+    // TRUNCATE. Returns false if other connections kept it from completing.
+    bool checkpoint(int mode = SQLITE_CHECKPOINT_PASSIVE, int * wal_frames = 0, int * checkpointed_frames = 0);
+    // Number of WAL pages after which a commit runs a checkpoint, zero to disable
+    void setAutoCheckpoint(int pages);
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    // Begins a read transaction and returns its snapshot of the main
+    // database, or null if none can be taken (e.g. outside WAL mode). The
+    // snapshot stays usable while the transaction is open and is freed with
+    // sqlite3_snapshot_free().
+    sqlite3_snapshot * getSnapshot();
+    // Begins a read transaction on a snapshot taken by another connection
+    // to the same database
+    void openSnapshot(sqlite3_snapshot * snapshot);
+#endif
+
+    // Replaces the main database with an in-memory copy of a database file
+    // that is read in one sequential pass through mmap. A file in WAL mode
+    // must have been checkpointed since its -wal file is not read.
+    void loadFromFile(const std::string & file);
+    // Writes a consistent copy of the main database to a temporary file with
+    // the backup API and renames it to file. Pages are copied pages_per_step
+    // at a time and other connections can write between the steps.
+    void saveToFile(const std::string & file, int pages_per_step = 1024);
+
+    std::vector<SQLitePlanStep> explainPlan(const std::string & query);
+
+    // Debug mode: prepare() runs EXPLAIN QUERY PLAN and calls the handler
+    // for every table scanned without an index. The handler may throw to
+    // fail the prepare. Pass an empty function to disable.
+    void setFullScanHandler(std::function<void (const std::string & query, const std::string & detail)> handler) { full_scan_handler = handler; }
+    static bool isFullScan(const std::string & detail);
+
+    // Opens a handle for incremental I/O on a single BLOB or TEXT cell
+    std::shared_ptr<SQLiteBlob> openBlob(const std::string & table, const std::string & column, long long rowid, bool writable = false);
+
+    // Registers a lambda as an SQL function. Argument and return types are
+    // converted with SQLiteValue and SQLiteResult (see SQLiteFunction.h).
+    template <class F>
+    void createFunction(const std::string & name, F func, bool is_deterministic = true) {
+      typedef SQLiteFunction<F> function;
+      registerFunction(name, function::arguments::size, is_deterministic, new F(std::move(func)),
+		       function::call, 0, 0, 0, 0, function::destroy);
+    }
+
+    // Registers an aggregate with a State object per group:
+    // step(State &, args...) and final(const State &) -> result
+    template <class State, class Step, class Final>
+    void createAggregate(const std::string & name, Step step, Final final, bool is_deterministic = true) {
+      typedef SQLiteAggregate<State, Step, Final> aggregate;
+      registerFunction(name, aggregate::arguments::size, is_deterministic, new aggregate{ step, final, step },
+		       0, aggregate::step, aggregate::final, 0, 0, aggregate::destroy);
+    }
+
+    // Registers an aggregate window function. inverse(State &, args...) removes
+    // a row that leaves the window and value() is final() without releasing the state.
+    template <class State, class Step, class Inverse, class Final>
+    void createWindowFunction(const std::string & name, Step step, Inverse inverse, Final final, bool is_deterministic = true) {
+      typedef SQLiteAggregate<State, Step, Final, Inverse> aggregate;
+      registerFunction(name, aggregate::arguments::size, is_deterministic, new aggregate{ step, final, inverse },
+		       0, aggregate::step, aggregate::final, aggregate::value, aggregate::inverse, aggregate::destroy);
+    }
+
+    // Exposes an array of mapped structs (see StructMapping.h) as a read-only
+    // eponymous virtual table. The rows are not copied and must stay valid
+    // and unchanged while the connection is open. If key_column is given,
+    // equality lookups on that column use a hash index.
+    template <class T>
+    void createVirtualTable(const std::string & name, const T * rows, size_t num_rows, const std::vector<std::string> & column_names, int key_column = -1) {
+      std::vector<FieldType> column_types(StructMapping<T>::size);
+      StructMapping<T>::getTypes(column_types.data());
+      auto get_row = [rows](size_t row, field_s * fields) {
+	StructMapping<T>::getFields(const_cast<T &>(rows[row]), fields);
+      };
+      registerVirtualTable(name, new SQLiteVirtualTable(column_names, column_types, num_rows, get_row, key_column));
+    }
+    template <class T>
+    void createVirtualTable(const std::string & name, const std::vector<T> & rows, const std::vector<std::string> & column_names, int key_column = -1) {
+      createVirtualTable(name, rows.data(), rows.size(), column_names, key_column);
+    }
   
   private:
     bool open(bool read_only);
+    void registerVirtualTable(const std::string & name, SQLiteVirtualTable * table);
+    void registerFunction(const std::string & name, int num_args, bool is_deterministic, void * user_data,
+			  void (*func)(sqlite3_context *, int, sqlite3_value **),
+			  void (*step)(sqlite3_context *, int, sqlite3_value **),
+			  void (*final)(sqlite3_context *),
+			  void (*value)(sqlite3_context *),
+			  void (*inverse)(sqlite3_context *, int, sqlite3_value **),
+			  void (*destroy)(void *));
   
     std::string db_file;
     sqlite3 * db;  
+    std::function<void (const std::string & query, const std::string & detail)> full_scan_handler;
   };
 
   class SQLiteStatement : public SQLStatement {
   public:
-    SQLiteStatement(sqlite3 * _db, sqlite3_stmt * _stmt);
+    SQLiteStatement(sqlite3 * _db, sqlite3_stmt * _stmt, std::shared_ptr<MemoryTracker> tracker = nullptr);
     ~SQLiteStatement();
   
     unsigned int execute() override;
     bool next() override;
+    // Errors of the last step are not reported again
     void reset() override;
+    // Stops the current execution of this statement only. It is checked by
+    // the progress handler, so a cancel between executions has no effect.
+    void cancel() override { is_cancelled = true; }
+
+    SQLStatus<unsigned int> tryExecute() override;
+    SQLStatus<bool> tryNext() override;
 
     SQLiteStatement & bind(int value, bool is_defined) override;
     SQLiteStatement & bind(long long value, bool is_defined) override;
@@ -39,26 +169,67 @@ namespace sqldb {
     SQLiteStatement & bind(const std::string & value, bool is_defined) override;
     SQLiteStatement & bind(const ustring & value, bool is_defined) override;
     SQLiteStatement & bind(const void* data, size_t len, bool is_defined) override;
+    SQLiteStatement & bindStream(std::istream & input, size_t len, bool is_defined = true) override;
+    SQLiteStatement & bindZeroBlob(size_t len, bool is_defined = true);
+    void bindRow(const field_s * fields, unsigned int num_fields) override;
   
     int getInt(int column_index) override;
     unsigned int getUInt(int column_index) override;
     double getDouble(int column_index) override;
     long long getLongLong(int column_index) override;
+    using SQLStatement::getText;
+    using SQLStatement::getBlob;
     std::string getText(int column_index) override;
     ustring getBlob(int column_index) override;
     bool getBool(int column_index) override;
+    void fetchRow(const field_s * fields, unsigned int num_fields) override;
 
+    size_t getBlobSize(int column_index) override;
+    size_t readBlob(int column_index, size_t offset, void * buffer, size_t len) override;
+
+    ColumnType getColumnType(int column_index) override;
+    bool isNull(int column_index) override;
     unsigned int getNumFields() override;
 
     long long getLastInsertId() const override;
     unsigned int getAffectedRows() const override;
+
+    SQLiteStatementStatus getStatus(bool reset_counters = false);
+    // Plan of the statement with unbound parameters as NULL
+    std::vector<SQLitePlanStep> explainPlan();
     
   protected:
     void step();
+    int tryStep();
+    static int checkProgress(void * arg);
     
   private:
     sqlite3_stmt * stmt;
     sqlite3 * db;
+    size_t tracked_memory = 0;
+    bool is_started = false, has_deadline = false;
+    std::atomic<bool> is_cancelled{false};
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  class SQLiteBlob {
+  public:
+    SQLiteBlob(sqlite3 * _db, sqlite3_blob * _blob);
+    SQLiteBlob(const SQLiteBlob & other) = delete;
+    ~SQLiteBlob();
+    SQLiteBlob & operator=(const SQLiteBlob & other) = delete;
+
+    size_t size() const;
+    size_t read(size_t offset, void * buffer, size_t len);
+    void write(size_t offset, const void * data, size_t len);
+    void reopen(long long rowid);
+
+    size_t read(std::ostream & output, size_t chunk_size = 0x10000);
+    size_t write(std::istream & input, size_t chunk_size = 0x10000);
+
+  private:
+    sqlite3 * db;
+    sqlite3_blob * blob;
   };
 };
 
@@ -0,0 +1,204 @@
+#ifndef _SQLDB_SQLITEFUNCTION_H_
+#define _SQLDB_SQLITEFUNCTION_H_
+
+#include "ustring.h"
+
+#include <sqlite3.h>
+
+#include <exception>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace sqldb {
+  // Conversion of function arguments. NULL arguments convert to zero or an
+  // empty value unless the parameter is a std::optional.
+  template <class T> struct SQLiteValue {
+    static_assert(sizeof(T) == 0, "Unsupported argument type for SQLite function");
+  };
+  template <> struct SQLiteValue<int> {
+    static int get(sqlite3_value * v) { return sqlite3_value_int(v); }
+  };
+  template <> struct SQLiteValue<unsigned int> {
+    static unsigned int get(sqlite3_value * v) { return (unsigned int)sqlite3_value_int64(v); }
+  };
+  template <> struct SQLiteValue<long long> {
+    static long long get(sqlite3_value * v) { return sqlite3_value_int64(v); }
+  };
+  template <> struct SQLiteValue<double> {
+    static double get(sqlite3_value * v) { return sqlite3_value_double(v); }
+  };
+  template <> struct SQLiteValue<bool> {
+    static bool get(sqlite3_value * v) { return sqlite3_value_int(v) != 0; }
+  };
+  // A string_view points into SQLite's copy of the value and is only valid during the call
+  template <> struct SQLiteValue<std::string_view> {
+    static std::string_view get(sqlite3_value * v) {
+      const char * s = (const char *)sqlite3_value_text(v);
+      return s ? std::string_view(s, sqlite3_value_bytes(v)) : std::string_view();
+    }
+  };
+  template <> struct SQLiteValue<std::string> {
+    static std::string get(sqlite3_value * v) { return std::string(SQLiteValue<std::string_view>::get(v)); }
+  };
+  template <> struct SQLiteValue<ustring> {
+    static ustring get(sqlite3_value * v) {
+      const unsigned char * s = (const unsigned char *)sqlite3_value_blob(v);
+      return s ? ustring(s, sqlite3_value_bytes(v)) : ustring();
+    }
+  };
+  template <class T> struct SQLiteValue<std::optional<T> > {
+    static std::optional<T> get(sqlite3_value * v) {
+      if (sqlite3_value_type(v) == SQLITE_NULL) return std::nullopt;
+      return SQLiteValue<T>::get(v);
+    }
+  };
+
+  // Conversion of return values. An empty std::optional returns NULL.
+  template <class T> struct SQLiteResult {
+    static_assert(sizeof(T) == 0, "Unsupported return type for SQLite function");
+  };
+  template <> struct SQLiteResult<int> {
+    static void set(sqlite3_context * ctx, int value) { sqlite3_result_int(ctx, value); }
+  };
+  template <> struct SQLiteResult<unsigned int> {
+    static void set(sqlite3_context * ctx, unsigned int value) { sqlite3_result_int64(ctx, value); }
+  };
+  template <> struct SQLiteResult<long long> {
+    static void set(sqlite3_context * ctx, long long value) { sqlite3_result_int64(ctx, value); }
+  };
+  template <> struct SQLiteResult<double> {
+    static void set(sqlite3_context * ctx, double value) { sqlite3_result_double(ctx, value); }
+  };
+  template <> struct SQLiteResult<bool> {
+    static void set(sqlite3_context * ctx, bool value) { sqlite3_result_int(ctx, value ? 1 : 0); }
+  };
+  template <> struct SQLiteResult<std::string_view> {
+    static void set(sqlite3_context * ctx, std::string_view value) {
+      sqlite3_result_text64(ctx, value.data(), value.size(), SQLITE_TRANSIENT, SQLITE_UTF8);
+    }
+  };
+  template <> struct SQLiteResult<std::string> {
+    static void set(sqlite3_context * ctx, const std::string & value) { SQLiteResult<std::string_view>::set(ctx, value); }
+  };
+  template <> struct SQLiteResult<ustring> {
+    static void set(sqlite3_context * ctx, const ustring & value) {
+      sqlite3_result_blob64(ctx, value.data(), value.size(), SQLITE_TRANSIENT);
+    }
+  };
+  template <class T> struct SQLiteResult<std::optional<T> > {
+    static void set(sqlite3_context * ctx, const std::optional<T> & value) {
+      if (value) SQLiteResult<T>::set(ctx, *value);
+      else sqlite3_result_null(ctx);
+    }
+  };
+
+  // Return and argument types of a lambda, function object or function pointer
+  template <class F> struct FunctionTraits : FunctionTraits<decltype(&F::operator())> { };
+  template <class R, class... A> struct FunctionTraits<R (*)(A...)> {
+    typedef R result_type;
+    typedef std::tuple<std::decay_t<A>...> argument_types;
+  };
+  template <class C, class R, class... A> struct FunctionTraits<R (C::*)(A...)> : FunctionTraits<R (*)(A...)> { };
+  template <class C, class R, class... A> struct FunctionTraits<R (C::*)(A...) const> : FunctionTraits<R (*)(A...)> { };
+
+  template <class Tuple> struct SQLiteArguments;
+  template <class... A> struct SQLiteArguments<std::tuple<A...> > {
+    static constexpr int size = sizeof...(A);
+
+    template <class F, class... Prefix, size_t... I>
+    static decltype(auto) apply(F & func, sqlite3_value ** argv, std::index_sequence<I...>, Prefix &... prefix) {
+      return func(prefix..., SQLiteValue<A>::get(argv[I])...);
+    }
+    template <class F, class... Prefix>
+    static decltype(auto) call(F & func, sqlite3_value ** argv, Prefix &... prefix) {
+      return apply(func, argv, std::index_sequence_for<A...>(), prefix...);
+    }
+  };
+
+  // Drops the leading state argument of aggregate step functions
+  template <class Tuple> struct TupleTail;
+  template <class H, class... T> struct TupleTail<std::tuple<H, T...> > {
+    typedef std::tuple<T...> type;
+  };
+
+  template <class F>
+  struct SQLiteFunction {
+    typedef FunctionTraits<F> traits;
+    typedef SQLiteArguments<typename traits::argument_types> arguments;
+
+    static void call(sqlite3_context * ctx, int, sqlite3_value ** argv) {
+      F & func = *(F *)sqlite3_user_data(ctx);
+      try {
+	SQLiteResult<std::decay_t<typename traits::result_type> >::set(ctx, arguments::call(func, argv));
+      } catch (std::exception & e) {
+	sqlite3_result_error(ctx, e.what(), -1);
+      }
+    }
+    static void destroy(void * ptr) { delete (F *)ptr; }
+  };
+
+  // Aggregate and window functions keep a State object per group. The
+  // aggregate context only holds a pointer to it, since State may not be
+  // trivially constructible.
+  template <class State, class Step, class Final, class Inverse = Step>
+  struct SQLiteAggregate {
+    typedef SQLiteArguments<typename TupleTail<typename FunctionTraits<Step>::argument_types>::type> arguments;
+    typedef std::decay_t<typename FunctionTraits<Final>::result_type> result_type;
+
+    Step step_func;
+    Final final_func;
+    Inverse inverse_func;
+
+    static State * getState(sqlite3_context * ctx, bool create) {
+      State ** ptr = (State **)sqlite3_aggregate_context(ctx, create ? sizeof(State *) : 0);
+      if (!ptr) return 0;
+      if (!*ptr && create) *ptr = new State();
+      return *ptr;
+    }
+    static void step(sqlite3_context * ctx, int, sqlite3_value ** argv) {
+      SQLiteAggregate & a = *(SQLiteAggregate *)sqlite3_user_data(ctx);
+      try {
+	State * state = getState(ctx, true);
+	if (!state) {
+	  sqlite3_result_error_nomem(ctx);
+	  return;
+	}
+	arguments::call(a.step_func, argv, *state);
+      } catch (std::exception & e) {
+	sqlite3_result_error(ctx, e.what(), -1);
+      }
+    }
+    static void inverse(sqlite3_context * ctx, int, sqlite3_value ** argv) {
+      SQLiteAggregate & a = *(SQLiteAggregate *)sqlite3_user_data(ctx);
+      try {
+	State * state = getState(ctx, true);
+	if (state) arguments::call(a.inverse_func, argv, *state);
+      } catch (std::exception & e) {
+	sqlite3_result_error(ctx, e.what(), -1);
+      }
+    }
+    // Returns the current value of a window without releasing the state
+    static void value(sqlite3_context * ctx) {
+      SQLiteAggregate & a = *(SQLiteAggregate *)sqlite3_user_data(ctx);
+      try {
+	State * state = getState(ctx, false);
+	State empty;
+	SQLiteResult<result_type>::set(ctx, a.final_func(state ? *state : empty));
+      } catch (std::exception & e) {
+	sqlite3_result_error(ctx, e.what(), -1);
+      }
+    }
+    static void final(sqlite3_context * ctx) {
+      value(ctx);
+      State * state = getState(ctx, false);
+      delete state;
+    }
+    static void destroy(void * ptr) { delete (SQLiteAggregate *)ptr; }
+  };
+};
+
+#endif
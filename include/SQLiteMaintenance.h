@@ -0,0 +1,78 @@
+#ifndef _SQLDB_SQLITEMAINTENANCE_H_
+#define _SQLDB_SQLITEMAINTENANCE_H_
+
+#include "SQLite.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace sqldb {
+  struct SQLiteMaintenanceOptions {
+    int checkpoint_mode = SQLITE_CHECKPOINT_PASSIVE;
+    std::chrono::milliseconds checkpoint_interval{1000};
+    // checkpoints are skipped while the WAL is smaller than this
+    size_t wal_size_threshold = 0;
+    // a larger WAL is checkpointed with TRUNCATE so that it cannot grow
+    // without bound under constant readers (zero to disable)
+    size_t wal_size_limit = 64 * 1024 * 1024;
+    // PRAGMA optimize interval, zero to disable
+    std::chrono::seconds optimize_interval{3600};
+    // pages freed by PRAGMA incremental_vacuum with each optimize, zero to
+    // disable (requires auto_vacuum = INCREMENTAL)
+    unsigned int incremental_vacuum_pages = 0;
+  };
+
+  struct SQLiteMaintenanceStats {
+    std::atomic<unsigned long long> checkpoints{0};
+    std::atomic<unsigned long long> blocked_checkpoints{0}; // did not complete because of readers or writers
+    std::atomic<unsigned long long> errors{0};
+    std::atomic<unsigned long long> checkpoint_time_us{0}; // total
+    std::atomic<unsigned long long> last_checkpoint_us{0};
+    std::atomic<unsigned long long> max_checkpoint_us{0};
+    std::atomic<unsigned long long> wal_size{0}; // bytes before the last checkpoint
+    std::atomic<unsigned long long> wal_frames{0}, checkpointed_frames{0}; // of the last checkpoint
+    std::atomic<unsigned long long> optimizations{0};
+  };
+
+  // Runs WAL checkpoints and periodic optimization of a database file on a
+  // dedicated connection and thread. Writers attached with attach() stop
+  // checkpointing on commit, which keeps checkpoint I/O off their latency.
+  class SQLiteMaintenance {
+  public:
+    SQLiteMaintenance(const std::string & db_file, const SQLiteMaintenanceOptions & _options = SQLiteMaintenanceOptions());
+    SQLiteMaintenance(const SQLiteMaintenance & other) = delete;
+    ~SQLiteMaintenance();
+    SQLiteMaintenance & operator=(const SQLiteMaintenance & other) = delete;
+
+    // Disables automatic checkpoints on a writer connection
+    void attach(SQLite & writer) { writer.setAutoCheckpoint(0); }
+
+    // Runs a checkpoint now on the calling thread. Returns false if it was blocked.
+    bool checkpoint(int mode);
+    void optimize();
+
+    const SQLiteMaintenanceStats & getStats() const { return stats; }
+    // Current size of the -wal file in bytes
+    size_t getWALSize() const;
+
+  private:
+    void run();
+
+    std::string db_file;
+    SQLiteMaintenanceOptions options;
+    SQLiteMaintenanceStats stats;
+    std::unique_ptr<SQLite> db;
+    std::mutex mutex; // serializes use of db
+    std::mutex stop_mutex;
+    std::condition_variable stop_cond;
+    bool is_stopping = false;
+    std::thread thread;
+  };
+};
+
+#endif
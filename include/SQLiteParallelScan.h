@@ -0,0 +1,62 @@
+#ifndef _SQLDB_SQLITEPARALLELSCAN_H_
+#define _SQLDB_SQLITEPARALLELSCAN_H_
+
+#include "SQLite.h"
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace sqldb {
+  struct ParallelScanOptions {
+    unsigned int num_threads = 0; // hardware concurrency if zero
+    unsigned int ranges_per_thread = 8; // smaller ranges even out skewed keys
+    std::string key_column = "rowid"; // rowid or an INTEGER PRIMARY KEY
+    // called for each worker connection after it has been opened
+    std::function<void (SQLite &)> setup;
+  };
+
+  // Splits the keys of a table into at most num_ranges inclusive ranges of
+  // equal width
+  std::vector<std::pair<long long, long long> > getKeyRanges(SQLite & db, const std::string & table, const std::string & key_column, size_t num_ranges);
+
+  // Returns the number of worker threads used with the options
+  unsigned int getNumScanWorkers(const ParallelScanOptions & options);
+
+  // Runs the query on each key range with :lo and :hi bound. Each worker
+  // thread opens its own read-only connection and calls func(worker, stmt)
+  // for every range it takes. The first exception is rethrown after all
+  // workers have stopped.
+  // With SQLITE_ENABLE_SNAPSHOT and a database in WAL mode all workers read
+  // the snapshot the ranges were computed from. Otherwise each worker reads
+  // its own snapshot and rows written during the scan may be seen by some
+  // ranges and not by others.
+  void runParallelScan(const std::string & db_file, const std::string & table, const std::string & query,
+		       const ParallelScanOptions & options,
+		       const std::function<void (unsigned int worker, SQLStatement & stmt)> & func);
+
+  // Scans a table in parallel. query must restrict the key to :lo..:hi, e.g.
+  // "SELECT a, b FROM t WHERE rowid BETWEEN :lo AND :hi". row_func(stmt, T &)
+  // is called for every row with the partial result of its worker and the
+  // partial results are then reduced with combine(T & result, T && partial).
+  // T() must be an empty partial result.
+  template <class T, class RowFunc, class Combine>
+  T parallelScan(const std::string & db_file, const std::string & table, const std::string & query,
+		 RowFunc row_func, Combine combine, const ParallelScanOptions & options = ParallelScanOptions()) {
+    std::vector<T> partials(getNumScanWorkers(options));
+    runParallelScan(db_file, table, query, options, [&](unsigned int worker, SQLStatement & stmt) {
+	T & partial = partials[worker];
+	while (stmt.next()) {
+	  row_func(stmt, partial);
+	}
+      });
+    T result = T();
+    for (auto & partial : partials) {
+      combine(result, std::move(partial));
+    }
+    return result;
+  }
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _SQLDB_SQLITEVIRTUALTABLE_H_
+#define _SQLDB_SQLITEVIRTUALTABLE_H_
+
+#include "StructMapping.h"
+
+#include <sqlite3.h>
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sqldb {
+  // Read-only eponymous virtual table over an array of mapped structs (see
+  // SQLite::createVirtualTable). The rowid is the array index, and an
+  // optional key column is indexed with a hash table so that equality
+  // constraints on the rowid or the key are answered without a scan.
+  class SQLiteVirtualTable {
+  public:
+    SQLiteVirtualTable(const std::vector<std::string> & _column_names, const std::vector<FieldType> & _column_types,
+		       size_t _num_rows, std::function<void (size_t, field_s *)> _get_row, int _key_column = -1);
+
+    const std::string & getSchema() const { return schema; }
+
+    static sqlite3_module module;
+
+  private:
+    struct vtab_s {
+      sqlite3_vtab base;
+      SQLiteVirtualTable * table;
+    };
+
+    struct cursor_s {
+      sqlite3_vtab_cursor base;
+      SQLiteVirtualTable * table;
+      std::vector<size_t> matches;
+      bool use_matches;
+      size_t pos, end;
+      std::vector<field_s> fields;
+      size_t fields_row;
+    };
+
+    enum index_mode { SCAN = 0, ROWID_LOOKUP, KEY_LOOKUP };
+
+    void lookupKey(sqlite3_value * value, std::vector<size_t> & rows) const;
+
+    static int xConnect(sqlite3 * db, void * aux, int argc, const char * const * argv, sqlite3_vtab ** vtab, char ** err);
+    static int xDisconnect(sqlite3_vtab * vtab);
+    static int xBestIndex(sqlite3_vtab * vtab, sqlite3_index_info * info);
+    static int xOpen(sqlite3_vtab * vtab, sqlite3_vtab_cursor ** cursor);
+    static int xClose(sqlite3_vtab_cursor * cursor);
+    static int xFilter(sqlite3_vtab_cursor * cursor, int idx_num, const char * idx_str, int argc, sqlite3_value ** argv);
+    static int xNext(sqlite3_vtab_cursor * cursor);
+    static int xEof(sqlite3_vtab_cursor * cursor);
+    static int xColumn(sqlite3_vtab_cursor * cursor, sqlite3_context * ctx, int column_index);
+    static int xRowid(sqlite3_vtab_cursor * cursor, sqlite3_int64 * rowid);
+
+    std::vector<std::string> column_names;
+    std::vector<FieldType> column_types;
+    size_t num_rows;
+    std::function<void (size_t, field_s *)> get_row;
+    int key_column;
+    std::string schema;
+    std::unordered_multimap<long long, size_t> int_index;
+    std::unordered_multimap<std::string, size_t> text_index;
+  };
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef _SQLDB_SHARDEDCONNECTION_H_
+#define _SQLDB_SHARDEDCONNECTION_H_
+
+#include "Connection.h"
+#include "SQLStatement.h"
+#include "ResultSet.h"
+#include "ThreadPool.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define SHARDED_BATCH_SIZE 1024
+
+namespace sqldb {
+  // Column used to merge the sorted results of the shards
+  struct MergeKey {
+    int column_index;
+    bool descending = false;
+  };
+
+  // Connection over several backends that hold the same schema. Writes for
+  // a key go to the shard chosen by the shard function, while SELECTs from
+  // prepare() run on every shard in parallel and return the combined rows.
+  // prepare() and execute() reject other statements so that generic code
+  // cannot write the same row to every shard.
+  class ShardedConnection : public Connection {
+  public:
+    ShardedConnection(std::vector<std::shared_ptr<Connection> > _shards, size_t num_threads = 0);
+
+    // The default shard function is FNV-1a modulo the number of shards,
+    // which keeps the placement stable across builds
+    void setShardFunction(std::function<size_t (const std::string & key)> _shard_function) { shard_function = _shard_function; }
+    size_t getShardIndex(const std::string & key) const;
+    size_t getNumShards() const { return shards.size(); }
+    Connection & getShard(size_t index) { return *shards.at(index); }
+    Connection & getShardForKey(const std::string & key) { return *shards[getShardIndex(key)]; }
+
+    std::shared_ptr<SQLStatement> prepareForKey(const std::string & key, const std::string & query) { return getShardForKey(key).prepare(query); }
+    unsigned int executeForKey(const std::string & key, const std::string & query) { return getShardForKey(key).execute(query); }
+
+    // Returns a SELECT that runs on all shards. Rows are returned shard by
+    // shard, or merged on order_by if each shard sorts its rows by the same
+    // keys. Rows are fetched from each shard in batches, so only one batch
+    // per shard is held at a time.
+    std::shared_ptr<SQLStatement> prepare(const std::string & query) override;
+    std::shared_ptr<SQLStatement> prepare(const std::string & query, const std::vector<MergeKey> & order_by);
+
+    // Any statement on all shards, e.g. schema changes or writes to tables
+    // that are copied to every shard
+    std::shared_ptr<SQLStatement> prepareForAllShards(const std::string & query);
+    unsigned int executeOnAllShards(const std::string & query);
+
+    // Transactions are started and ended on every shard but the commit is not
+    // atomic across shards
+    void begin() override;
+    void commit() override;
+    void rollback() override;
+    // Only SELECTs, see executeOnAllShards()
+    unsigned int execute(const char * query) override;
+    bool ping() override;
+    void cancel() override;
+
+    ThreadPool & getThreadPool() { return *pool; }
+
+    // Runs func(shard_index) for every shard on the pool and rethrows the
+    // first exception after all calls have finished
+    void forEachShard(const std::function<void (size_t)> & func);
+
+  private:
+    void checkSelect(const std::string & query) const;
+
+    std::vector<std::shared_ptr<Connection> > shards;
+    std::shared_ptr<ThreadPool> pool;
+    std::function<size_t (const std::string & key)> shard_function;
+  };
+
+  class ShardedStatement : public SQLStatement {
+  public:
+    ShardedStatement(ShardedConnection & _conn, const std::string & query, const std::vector<MergeKey> & _order_by);
+
+    unsigned int execute() override;
+    bool next() override;
+    void reset() override;
+    void setTimeout(std::chrono::milliseconds _timeout) override;
+    void cancel() override;
+
+    ShardedStatement & bind(bool value, bool is_defined = true) override { return store(value, is_defined); }
+    ShardedStatement & bind(const std::string & value, bool is_defined = true) override { return store(value, is_defined); }
+    ShardedStatement & bind(double value, bool is_defined = true) override { return store(value, is_defined); }
+    ShardedStatement & bind(const ustring & value, bool is_defined = true) override { return store(value, is_defined); }
+    ShardedStatement & bind(int value, bool is_defined = true) override { return store(value, is_defined); }
+    ShardedStatement & bind(const char * value, bool is_defined = true) override { return store(std::string(value ? value : ""), is_defined); }
+    ShardedStatement & bind(unsigned int value, bool is_defined = true) override { return store(value, is_defined); }
+    ShardedStatement & bind(const void * data, size_t len, bool is_defined = true) override { return store(ustring((const unsigned char *)data, len), is_defined); }
+    ShardedStatement & bind(long long value, bool is_defined = true) override { return store(value, is_defined); }
+    ShardedStatement & bindStream(std::istream & input, size_t len, bool is_defined = true) override;
+
+    double getDouble(int column_index) override { return getResult().getDouble(getRow(), column_index); }
+    long long getLongLong(int column_index) override { return getResult().getLongLong(getRow(), column_index); }
+    using SQLStatement::getText;
+    using SQLStatement::getBlob;
+    ustring getBlob(int column_index) override { return getResult().getBlob(getRow(), column_index); }
+    int getInt(int column_index) override { return getResult().getInt(getRow(), column_index); }
+    bool getBool(int column_index) override { return getResult().getBool(getRow(), column_index); }
+    std::string getText(int column_index) override { return getResult().getText(getRow(), column_index); }
+    unsigned int getUInt(int column_index) override { return getResult().getUInt(getRow(), column_index); }
+    size_t getBlobSize(int column_index) override;
+    size_t readBlob(int column_index, size_t offset, void * buffer, size_t len) override;
+
+    bool isNull(int column_index) override { return getResult().isNull(getRow(), column_index); }
+    long long getLastInsertId() const override { return 0; }
+    unsigned int getAffectedRows() const override { return affected_rows; }
+    unsigned int getNumFields() override { return (unsigned int)columns.size(); }
+
+    // Index of the shard that returned the current row
+    size_t getCurrentShard() const { return current_shard; }
+    // Number of rows fetched from a shard at a time
+    void setBatchSize(size_t n) { batch_size = n ? n : 1; }
+
+  private:
+    template <class T>
+    ShardedStatement & store(T value, bool is_defined) {
+      unsigned int index = getNextBindIndex();
+      if (binds.size() < index) binds.resize(index);
+      binds[index - 1] = [value, is_defined](SQLStatement & stmt) { stmt.bind(value, is_defined); };
+      return *this;
+    }
+
+    void applyBinds(SQLStatement & stmt);
+    void gather();
+    bool refill(size_t shard);
+    bool isBefore(size_t a, size_t b) const;
+    const ResultSet & getResult() const;
+    size_t getRow() const { return positions[current_shard]; }
+
+    ShardedConnection & conn;
+    std::vector<std::shared_ptr<SQLStatement> > stmts;
+    std::vector<MergeKey> order_by;
+    std::vector<std::function<void (SQLStatement &)> > binds;
+    // current batch of each shard, its next row and the heap of shards with
+    // rows left
+    std::vector<std::shared_ptr<const ResultSet> > results;
+    std::vector<size_t> positions;
+    std::vector<bool> is_exhausted;
+    std::vector<size_t> heap;
+    size_t current_shard = 0, batch_size = SHARDED_BATCH_SIZE;
+    bool is_executed = false, is_gathered = false;
+    unsigned int affected_rows = 0;
+  };
+};
+
+#endif
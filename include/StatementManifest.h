@@ -0,0 +1,68 @@
+#ifndef _SQLDB_STATEMENTMANIFEST_H_
+#define _SQLDB_STATEMENTMANIFEST_H_
+
+#include "Connection.h"
+#include "SQLStatement.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sqldb {
+  class PreparedStatements;
+
+  // Named statements of an application. They are all prepared when a
+  // connection is set up, so that bad SQL fails at startup rather than at
+  // first use, and are then looked up by id instead of by SQL text.
+  class StatementManifest {
+  public:
+    StatementManifest() { }
+
+    // Registers a statement and returns its id, which is its index in the
+    // manifest. Throws if the name is already taken.
+    size_t add(const std::string & name, const std::string & query);
+
+    size_t size() const { return queries.size(); }
+    size_t getId(const std::string & name) const;
+    const std::string & getName(size_t id) const { return names.at(id); }
+    const std::string & getQuery(size_t id) const { return queries.at(id); }
+
+    // Prepares every statement on the connection. The first failure is
+    // rethrown with the name of the statement in the message.
+    std::shared_ptr<PreparedStatements> prepare(Connection & conn) const;
+
+    // Prepares the statements on all connections of a pool in parallel,
+    // one connection per thread, and returns the handles in the same order
+    std::vector<std::shared_ptr<PreparedStatements> > prepare(const std::vector<std::shared_ptr<Connection> > & conns, size_t num_threads = 0) const;
+
+  private:
+    std::vector<std::string> names, queries;
+    std::unordered_map<std::string, size_t> ids;
+  };
+
+  // Statements of a manifest prepared on one connection. Like the
+  // connection, it must be used from one thread at a time. The statement ids
+  // are copied, so the manifest need not outlive it.
+  class PreparedStatements {
+  public:
+    PreparedStatements(std::unordered_map<std::string, size_t> _ids, std::vector<std::shared_ptr<SQLStatement> > _stmts)
+      : ids(std::move(_ids)), stmts(std::move(_stmts)) { }
+
+    // Returns the statement reset and ready for binding
+    SQLStatement & get(size_t id) {
+      auto & stmt = *stmts.at(id);
+      stmt.reset();
+      return stmt;
+    }
+    SQLStatement & get(const std::string & name);
+
+    size_t size() const { return stmts.size(); }
+
+  private:
+    std::unordered_map<std::string, size_t> ids;
+    std::vector<std::shared_ptr<SQLStatement> > stmts;
+  };
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef _SQLDB_STRUCTMAPPING_H_
+#define _SQLDB_STRUCTMAPPING_H_
+
+#include "ustring.h"
+
+#include <string>
+#include <type_traits>
+
+namespace sqldb {
+  // Maps the members of a struct to bind parameters and result columns in
+  // order. A mapping is declared by specializing StructMapping:
+  //
+  //   template <> struct sqldb::StructMapping<Person>
+  //     : sqldb::Fields<&Person::id, &Person::name, &Person::score> { };
+  //
+  // Members of unsupported types are rejected at compile time.
+
+  enum FieldType {
+    FIELD_INT = 1,
+    FIELD_UINT,
+    FIELD_INT64,
+    FIELD_DOUBLE,
+    FIELD_BOOL,
+    FIELD_TEXT,
+    FIELD_BLOB
+  };
+
+  // Type and address of a single mapped member. Binding only reads through ptr.
+  struct field_s {
+    FieldType type;
+    void * ptr;
+  };
+
+  template <class T> struct FieldTypeOf {
+    static_assert(sizeof(T) == 0, "Unsupported member type in struct mapping");
+  };
+  template <> struct FieldTypeOf<int> { static constexpr FieldType value = FIELD_INT; };
+  template <> struct FieldTypeOf<unsigned int> { static constexpr FieldType value = FIELD_UINT; };
+  template <> struct FieldTypeOf<long long> { static constexpr FieldType value = FIELD_INT64; };
+  template <> struct FieldTypeOf<double> { static constexpr FieldType value = FIELD_DOUBLE; };
+  template <> struct FieldTypeOf<bool> { static constexpr FieldType value = FIELD_BOOL; };
+  template <> struct FieldTypeOf<std::string> { static constexpr FieldType value = FIELD_TEXT; };
+  template <> struct FieldTypeOf<ustring> { static constexpr FieldType value = FIELD_BLOB; };
+
+  template <class M> struct MemberPointer;
+  template <class C, class T> struct MemberPointer<T C::*> {
+    typedef C class_type;
+    typedef T member_type;
+  };
+
+  template <auto... members>
+  struct Fields {
+    static constexpr unsigned int size = sizeof...(members);
+    static_assert(size > 0, "Empty struct mapping");
+
+    template <class T>
+    static void getFields(T & obj, field_s * fields) {
+      static_assert((std::is_same<typename MemberPointer<decltype(members)>::class_type, T>::value && ...),
+		    "Struct mapping refers to members of another type");
+      unsigned int i = 0;
+      ((fields[i++] = field_s{ FieldTypeOf<typename MemberPointer<decltype(members)>::member_type>::value, &(obj.*members) }), ...);
+    }
+
+    static void getTypes(FieldType * types) {
+      unsigned int i = 0;
+      ((types[i++] = FieldTypeOf<typename MemberPointer<decltype(members)>::member_type>::value), ...);
+    }
+  };
+
+  template <class T> struct StructMapping;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef _SQLDB_SYNTHETIC_H_
+#define _SQLDB_SYNTHETIC_H_
+
+#include "Connection.h"
+#include "SQLStatement.h"
+
+#include <vector>
+
+namespace sqldb {
+  // Every statement returns the same deterministic rows
+  struct SyntheticOptions {
+    std::vector<SQLStatement::ColumnType> column_types = { SQLStatement::INT64, SQLStatement::TEXT };
+    size_t num_rows = 1000;
+    size_t value_size = 16; // length of TEXT and BLOB values
+    unsigned int affected_rows = 1;
+  };
+
+  // In-process backend without a database for measuring the overhead of the
+  // library itself. Rows are generated at memory speed and binds are
+  // checked but not stored.
+  class Synthetic : public Connection {
+  public:
+    Synthetic(const SyntheticOptions & _options = SyntheticOptions()) : options(_options) { }
+
+    std::shared_ptr<SQLStatement> prepare(const std::string & query) override;
+    void begin() override { }
+    void commit() override { }
+    void rollback() override { }
+    unsigned int execute(const char *) override { return options.affected_rows; }
+
+  private:
+    SyntheticOptions options;
+  };
+
+  class SyntheticStatement : public SQLStatement {
+  public:
+    SyntheticStatement(const std::string & _query, const SyntheticOptions & _options);
+
+    unsigned int execute() override;
+    bool next() override;
+    void reset() override;
+
+    SQLStatus<unsigned int> tryExecute() override { return execute(); }
+    SQLStatus<bool> tryNext() override { return next(); }
+
+    SyntheticStatement & bind(int, bool = true) override { return bindNext(); }
+    SyntheticStatement & bind(long long, bool = true) override { return bindNext(); }
+    SyntheticStatement & bind(unsigned int, bool = true) override { return bindNext(); }
+    SyntheticStatement & bind(double, bool = true) override { return bindNext(); }
+    SyntheticStatement & bind(const char *, bool = true) override { return bindNext(); }
+    SyntheticStatement & bind(bool, bool = true) override { return bindNext(); }
+    SyntheticStatement & bind(const std::string &, bool = true) override { return bindNext(); }
+    SyntheticStatement & bind(const ustring &, bool = true) override { return bindNext(); }
+    SyntheticStatement & bind(const void *, size_t, bool = true) override { return bindNext(); }
+    SyntheticStatement & bindStream(std::istream &, size_t, bool = true) override { return bindNext(); }
+
+    int getInt(int column_index) override { return (int)getValue(column_index); }
+    unsigned int getUInt(int column_index) override { return (unsigned int)getValue(column_index); }
+    double getDouble(int column_index) override { return getValue(column_index) * 0.5; }
+    long long getLongLong(int column_index) override { return getValue(column_index); }
+    bool getBool(int column_index) override { return getValue(column_index) & 1; }
+    using SQLStatement::getText;
+    using SQLStatement::getBlob;
+    std::string getText(int column_index) override;
+    ustring getBlob(int column_index) override;
+
+    size_t getBlobSize(int column_index) override;
+    size_t readBlob(int column_index, size_t offset, void * buffer, size_t len) override;
+
+    bool isNull(int column_index) override;
+    unsigned int getNumFields() override { return columns.size(); }
+
+    long long getLastInsertId() const override { return last_insert_id; }
+    unsigned int getAffectedRows() const override { return rows_affected; }
+
+  private:
+    SyntheticStatement & bindNext();
+    long long getValue(int column_index) const;
+    bool isNumeric(int column_index) const;
+    char getFillChar(int column_index) const { return 'a' + getValue(column_index) % 26; }
+
+    SyntheticOptions options;
+    unsigned int num_parameters = 0;
+    size_t current_row = 0;
+    bool is_query_executed = false;
+    long long last_insert_id = 0;
+    unsigned int rows_affected = 0;
+  };
+};
+
+#endif
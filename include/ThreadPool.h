@@ -0,0 +1,48 @@
+#ifndef _SQLDB_THREADPOOL_H_
+#define _SQLDB_THREADPOOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sqldb {
+  // Fixed set of worker threads for running queries in parallel
+  class ThreadPool {
+  public:
+    ThreadPool(size_t num_threads = 0);
+    ThreadPool(const ThreadPool & other) = delete;
+    ~ThreadPool();
+    ThreadPool & operator=(const ThreadPool & other) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    // Runs func on a worker. Exceptions are passed to the future.
+    template <class F>
+    auto submit(F func) -> std::future<decltype(func())> {
+      auto task = std::make_shared<std::packaged_task<decltype(func()) ()> >(std::move(func));
+      auto r = task->get_future();
+      {
+	std::lock_guard<std::mutex> guard(mutex);
+	queue.push_back([task]() { (*task)(); });
+      }
+      cond.notify_one();
+      return r;
+    }
+
+  private:
+    void run();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void ()> > queue;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool is_running = true;
+  };
+};
+
+#endif
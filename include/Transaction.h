@@ -0,0 +1,41 @@
+#ifndef _SQLDB_TRANSACTION_H_
+#define _SQLDB_TRANSACTION_H_
+
+#include "Connection.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+namespace sqldb {
+  // Counters that can be shared by many threads and runners
+  struct TransactionStats {
+    std::atomic<unsigned long long> transactions{0}; // committed
+    std::atomic<unsigned long long> failures{0}; // gave up or not retryable
+    std::atomic<unsigned long long> retries{0};
+    std::atomic<unsigned long long> time_lost_us{0}; // failed attempts and backoff
+  };
+
+  struct TransactionPolicy {
+    unsigned int max_attempts = 5;
+    std::chrono::milliseconds initial_backoff{10};
+    std::chrono::milliseconds max_backoff{1000};
+    double backoff_multiplier = 2.0;
+    // total time for all attempts, zero for no limit
+    std::chrono::milliseconds deadline{10000};
+    TransactionStats * stats = 0;
+  };
+
+  // Runs func in a transaction and commits it. If func or the commit fails
+  // with a retryable error (SQLException::isRetryable()), the transaction is
+  // rolled back and run again after an exponential backoff with jitter until
+  // max_attempts or the deadline is reached. func must not have side effects
+  // outside the database that cannot be repeated.
+  //
+  // A nested call on the same connection runs in a savepoint and is not
+  // retried on its own: conflicts are passed to the outermost runner since
+  // they roll back the whole transaction.
+  void runTransaction(Connection & conn, const std::function<void ()> & func, const TransactionPolicy & policy = TransactionPolicy());
+};
+
+#endif
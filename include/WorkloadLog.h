@@ -0,0 +1,103 @@
+#ifndef _SQLDB_WORKLOADLOG_H_
+#define _SQLDB_WORKLOADLOG_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sqldb {
+  struct WorkloadParameter {
+    enum Type { NULL_VALUE = 0, INT, DOUBLE, TEXT, BLOB };
+
+    Type type = NULL_VALUE;
+    long long int_value = 0;
+    double double_value = 0;
+    std::string data;
+  };
+
+  struct WorkloadRecord {
+    enum Type { PREPARE = 1, EXECUTE, ROWS, BATCH_ADD, BATCH_EXECUTE, QUERY, BEGIN, COMMIT, ROLLBACK };
+
+    Type type;
+    unsigned int session; // one per recorded connection
+    unsigned long long timestamp_ns; // since the log was opened
+    unsigned long long statement_id;
+    unsigned long long duration_ns;
+    unsigned long long rows; // affected or fetched rows
+    std::string query; // PREPARE and QUERY
+    std::vector<WorkloadParameter> parameters; // EXECUTE and BATCH_ADD
+  };
+
+  // Binary log of statement traffic. Each recording thread appends encoded
+  // records to its own single-producer ring buffer without locking and a
+  // writer thread drains the rings into the file. Records that do not fit
+  // into a full ring are dropped and counted instead of blocking the caller.
+  class WorkloadLog {
+  public:
+    WorkloadLog(const std::string & filename, size_t ring_size = 1 << 20);
+    WorkloadLog(const WorkloadLog & other) = delete;
+    ~WorkloadLog();
+    WorkloadLog & operator=(const WorkloadLog & other) = delete;
+
+    void append(const WorkloadRecord & record);
+    unsigned long long getTimestamp() const;
+    unsigned int createSession() { return ++num_sessions; }
+    unsigned long long createStatementId() { return ++num_statements; }
+
+    unsigned long long getDroppedRecords() const { return dropped_records; }
+    unsigned long long getWrittenBytes() const { return written_bytes; }
+
+    // Reads all records of a log file in file order
+    static std::vector<WorkloadRecord> read(const std::string & filename);
+
+  private:
+    class Ring {
+    public:
+      Ring(size_t _capacity) : capacity(_capacity), buffer(new char[_capacity]) { }
+
+      bool push(const char * data, size_t len);
+      size_t drain(FILE * out);
+
+      // A ring whose thread has exited is released and taken over by the
+      // next new thread
+      void release() { is_free.store(true, std::memory_order_release); }
+      bool acquire() {
+	bool expected = true;
+	return is_free.compare_exchange_strong(expected, false, std::memory_order_acq_rel);
+      }
+
+    private:
+      size_t capacity;
+      std::unique_ptr<char[]> buffer;
+      alignas(64) std::atomic<size_t> head{0}; // written by the producer
+      alignas(64) std::atomic<size_t> tail{0}; // written by the writer thread
+      std::atomic<bool> is_free{false};
+    };
+    struct ThreadRings;
+
+    Ring * getRing();
+    void run();
+    size_t drainAll();
+
+    FILE * out = 0;
+    size_t ring_size;
+    unsigned long long id;
+    std::chrono::steady_clock::time_point started;
+    std::mutex rings_mutex;
+    std::vector<std::shared_ptr<Ring> > rings;
+    std::atomic<bool> is_running{true};
+    std::atomic<unsigned int> num_sessions{0};
+    std::atomic<unsigned long long> num_statements{0};
+    std::atomic<unsigned long long> dropped_records{0};
+    std::atomic<unsigned long long> written_bytes{0};
+    std::thread writer;
+  };
+};
+
+#endif
@@ -2,6 +2,9 @@
 #define _USTRING_H_
 
 #include <string>
+#include <memory_resource>
+
 typedef std::basic_string<unsigned char> ustring;
+typedef std::pmr::basic_string<unsigned char> pmr_ustring;
 
 #endif
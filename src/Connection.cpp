@@ -25,3 +25,29 @@ void
 Connection::rollback() {
   execute("ROLLBACK");
 }
+
+void
+Connection::savepoint(const std::string & name) {
+  execute("SAVEPOINT " + name);
+}
+
+void
+Connection::releaseSavepoint(const std::string & name) {
+  execute("RELEASE SAVEPOINT " + name);
+}
+
+void
+Connection::rollbackToSavepoint(const std::string & name) {
+  execute("ROLLBACK TO SAVEPOINT " + name);
+}
+
+void
+Connection::setMemoryLimits(size_t soft_limit, size_t hard_limit) {
+  if (!memory_tracker) memory_tracker = make_shared<MemoryTracker>();
+  memory_tracker->setLimits(soft_limit, hard_limit);
+}
+
+std::shared_ptr<MemoryTracker>
+Connection::createStatementTracker() const {
+  return memory_tracker ? make_shared<MemoryTracker>(memory_tracker) : nullptr;
+}
@@ -0,0 +1,83 @@
+#include "MemoryTracker.h"
+
+#include "SQLException.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+using namespace sqldb;
+
+MemoryTracker::MemoryTracker(std::shared_ptr<MemoryTracker> _parent, std::pmr::memory_resource * _upstream)
+  : parent(_parent),
+    upstream(_upstream ? _upstream : std::pmr::get_default_resource())
+{
+}
+
+// Memory still counted here is no longer held by the owner
+MemoryTracker::~MemoryTracker() {
+  if (parent && usage) parent->remove(usage);
+}
+
+void
+MemoryTracker::add(size_t bytes) {
+  size_t new_usage = usage += bytes;
+  if (hard_limit && new_usage > hard_limit) {
+    usage -= bytes;
+    throw SQLException(SQLException::RESOURCE_LIMIT, "Memory limit of " + to_string(hard_limit) + " bytes exceeded");
+  }
+  if (parent) {
+    try {
+      parent->add(bytes);
+    } catch (...) {
+      usage -= bytes;
+      throw;
+    }
+  }
+  size_t peak = peak_usage;
+  while (new_usage > peak && !peak_usage.compare_exchange_weak(peak, new_usage)) { }
+}
+
+void
+MemoryTracker::remove(size_t bytes) {
+  usage -= bytes;
+  if (parent) parent->remove(bytes);
+}
+
+bool
+MemoryTracker::isOverSoftLimit() const {
+  if (soft_limit && usage > soft_limit) return true;
+  return parent && parent->isOverSoftLimit();
+}
+
+static size_t
+getHeadroom(size_t limit, size_t usage) {
+  if (!limit) return SIZE_MAX;
+  return usage < limit ? limit - usage : 0;
+}
+
+size_t
+MemoryTracker::getAvailable() const {
+  size_t current = usage;
+  size_t available = min(getHeadroom(soft_limit, current), getHeadroom(hard_limit, current));
+  if (parent) available = min(available, parent->getAvailable());
+  return available;
+}
+
+void *
+MemoryTracker::do_allocate(size_t bytes, size_t alignment) {
+  add(bytes);
+  try {
+    return upstream->allocate(bytes, alignment);
+  } catch (...) {
+    remove(bytes);
+    throw;
+  }
+}
+
+void
+MemoryTracker::do_deallocate(void * p, size_t bytes, size_t alignment) {
+  upstream->deallocate(p, bytes, alignment);
+  remove(bytes);
+}
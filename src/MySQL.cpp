@@ -11,6 +11,32 @@
 using namespace std;
 using namespace sqldb;
 
+static SQLException::ErrorType
+getErrorType(unsigned int error, SQLException::ErrorType default_type = SQLException::EXECUTE_FAILED) {
+  switch (error) {
+  case 1048: // ER_BAD_NULL_ERROR
+  case 1062: // ER_DUP_ENTRY
+  case 1216: // ER_NO_REFERENCED_ROW
+  case 1217: // ER_ROW_IS_REFERENCED
+  case 1451: // ER_ROW_IS_REFERENCED_2
+  case 1452: // ER_NO_REFERENCED_ROW_2
+  case 1557: // ER_FOREIGN_DUPLICATE_KEY
+  case 1586: // ER_DUP_ENTRY_WITH_KEY_NAME
+  case 3819: // ER_CHECK_CONSTRAINT_VIOLATED
+    return SQLException::CONSTRAINT_VIOLATION;
+  case 1213: // ER_LOCK_DEADLOCK
+    return SQLException::DEADLOCK;
+  case 1205: // ER_LOCK_WAIT_TIMEOUT
+    return SQLException::LOCK_WAIT_TIMEOUT;
+  case 1317: // ER_QUERY_INTERRUPTED
+    return SQLException::QUERY_CANCELLED;
+  case 3024: // ER_QUERY_TIMEOUT (MAX_EXECUTION_TIME)
+    return SQLException::QUERY_TIMED_OUT;
+  default:
+    return default_type;
+  }
+}
+
 MySQL::~MySQL() {
   if (conn) mysql_close(conn);
 }
@@ -23,8 +49,10 @@ MySQL::begin() {
 void
 MySQL::commit() {
   if (mysql_commit(conn) != 0) {
+    SQLException::ErrorType type = getErrorType(mysql_errno(conn), SQLException::COMMIT_FAILED);
+    string errmsg = mysql_error(conn);
     mysql_autocommit(conn, 1); // enable autocommit
-    throw SQLException(SQLException::COMMIT_FAILED);
+    throw SQLException(type, errmsg);
   } else {
     mysql_autocommit(conn, 1); // enable autocommit
   }
@@ -45,6 +73,8 @@ MySQL::prepare(const std::string & query) {
   if (!conn) {
     throw SQLException(SQLException::PREPARE_FAILED, "Not connected", query);
   }
+  std::vector<std::string> parameter_names;
+  string rewritten_query = SQLStatement::rewriteNamedParameters(query, parameter_names);
   MYSQL_STMT * stmt = 0;
   while ( 1 ) {
     if (stmt) mysql_stmt_close(stmt);	
@@ -55,7 +85,7 @@ MySQL::prepare(const std::string & query) {
       }
       throw SQLException(SQLException::PREPARE_FAILED, mysql_error(conn), query);
     }
-    if (mysql_stmt_prepare(stmt, query.c_str(), query.size()) != 0) {
+    if (mysql_stmt_prepare(stmt, rewritten_query.c_str(), rewritten_query.size()) != 0) {
       if (mysql_errno(conn) == 2006) {
 	continue;
       }
@@ -63,16 +93,20 @@ MySQL::prepare(const std::string & query) {
     }
     break;
   }
-  return std::make_shared<MySQLStatement>(stmt, query);
+  auto mysql_stmt = std::make_shared<MySQLStatement>(stmt, query, parameter_names, createStatementTracker());
+  mysql_stmt->setWatchdog(watchdog);
+  mysql_stmt->setTimeout(getQueryTimeout());
+  return mysql_stmt;
 }
 
 bool
-MySQL::connect(const string & _host_name, int _port, const string & _user_name, const string & _password, const string & _db_name) {
+MySQL::connect(const string & _host_name, int _port, const string & _user_name, const string & _password, const string & _db_name, const MySQLOptions & _options) {
   host_name = _host_name;
   port = _port;
   user_name = _user_name;
   password = _password;
   db_name = _db_name;
+  options = _options;
   
   return connect();
 }
@@ -85,16 +119,57 @@ MySQL::connect() {
     return false;
   }
 
-  int flags = CLIENT_FOUND_ROWS; 
+  if (!setOptions()) {
+    mysql_close(conn);
+    conn = 0;
+    return false;
+  }
+
+  int flags = options.found_rows ? CLIENT_FOUND_ROWS : 0;
+  const char * unix_socket = options.unix_socket.empty() ? 0 : options.unix_socket.c_str();
 
-  if (!mysql_real_connect(conn, host_name.c_str(), user_name.c_str(), password.c_str(), db_name.c_str(), port, 0, flags)) {
+  if (!mysql_real_connect(conn, host_name.c_str(), user_name.c_str(), password.c_str(), db_name.c_str(), port, unix_socket, flags)) {
     const char * errmsg = mysql_error(conn);
     mysql_close(conn);
     conn = 0;
     return false;
   }
+
+  if (!watchdog) watchdog = make_shared<MySQLWatchdog>(host_name, port, user_name, password, options);
+  watchdog->setThreadId(mysql_thread_id(conn));
   
-  execute("SET NAMES utf8mb4");
+  return true;
+}
+
+// The charset is set with the handshake instead of a separate SET NAMES
+bool
+MySQL::setOptions() {
+  if (options.connect_timeout && mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &options.connect_timeout)) return false;
+  if (options.read_timeout && mysql_options(conn, MYSQL_OPT_READ_TIMEOUT, &options.read_timeout)) return false;
+  if (options.write_timeout && mysql_options(conn, MYSQL_OPT_WRITE_TIMEOUT, &options.write_timeout)) return false;
+  if (options.max_allowed_packet && mysql_options(conn, MYSQL_OPT_MAX_ALLOWED_PACKET, &options.max_allowed_packet)) return false;
+  if (!options.charset.empty() && mysql_options(conn, MYSQL_SET_CHARSET_NAME, options.charset.c_str())) return false;
+
+  if (!options.unix_socket.empty()) {
+    unsigned int protocol = MYSQL_PROTOCOL_SOCKET;
+    if (mysql_options(conn, MYSQL_OPT_PROTOCOL, &protocol)) return false;
+  }
+
+  if (options.compression != MySQLOptions::COMPRESSION_NONE) {
+#if defined(MYSQL_VERSION_ID) && MYSQL_VERSION_ID >= 80018 && !defined(MARIADB_BASE_VERSION)
+    const char * algorithm = options.compression == MySQLOptions::COMPRESSION_ZSTD ? "zstd" : "zlib";
+    if (mysql_options(conn, MYSQL_OPT_COMPRESSION_ALGORITHMS, algorithm)) return false;
+    if (options.compression == MySQLOptions::COMPRESSION_ZSTD &&
+	mysql_options(conn, MYSQL_OPT_ZSTD_COMPRESSION_LEVEL, &options.zstd_level)) return false;
+#else
+    // older clients only support zlib
+    if (mysql_options(conn, MYSQL_OPT_COMPRESS, 0)) return false;
+#endif
+  }
+
+  for (auto & a : options.connect_attributes) {
+    if (mysql_options4(conn, MYSQL_OPT_CONNECT_ATTR_ADD, a.first.c_str(), a.second.c_str())) return false;
+  }
   
   return true;
 }
@@ -108,25 +183,216 @@ MySQL::ping() {
   }
 }
 
+std::string
+MySQL::getLastGTID() const {
+#if defined(MYSQL_VERSION_ID) && MYSQL_VERSION_ID >= 50704 && !defined(MARIADB_BASE_VERSION)
+  const char * data = 0;
+  size_t len = 0;
+  if (conn && mysql_session_track_get_first(conn, SESSION_TRACK_GTIDS, &data, &len) == 0) {
+    return string(data, len);
+  }
+#endif
+  return string();
+}
+
+bool
+MySQL::hasGTIDTracking() {
+#if defined(MYSQL_VERSION_ID) && MYSQL_VERSION_ID >= 50704 && !defined(MARIADB_BASE_VERSION)
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool
+MySQL::waitForGTID(const std::string & gtid_set, unsigned int timeout_seconds) {
+  auto stmt = prepare("SELECT WAIT_FOR_EXECUTED_GTID_SET(?, ?)");
+  stmt->bind(gtid_set);
+  stmt->bind(timeout_seconds);
+  // returns 0 when applied and 1 on timeout
+  return stmt->next() && !stmt->isNull(0) && stmt->getInt(0) == 0;
+}
+
+void
+MySQL::cancel() {
+  if (watchdog) watchdog->cancel();
+}
+
 unsigned int
 MySQL::execute(const char * query) {
-  if (mysql_query(conn, query) != 0) {
-    throw SQLException(SQLException::EXECUTE_FAILED, mysql_error(conn), query);
+  bool has_deadline = watchdog && getQueryTimeout().count() > 0;
+  if (has_deadline) watchdog->arm(getQueryTimeout());
+  int status = mysql_query(conn, query);
+  bool has_fired = has_deadline && watchdog->disarm();
+  if (status != 0) {
+    SQLException::ErrorType type = getErrorType(mysql_errno(conn));
+    if (has_fired && type == SQLException::QUERY_CANCELLED) type = SQLException::QUERY_TIMED_OUT;
+    throw SQLException(type, mysql_error(conn), query);
   }
   long long r = (long long)mysql_affected_rows(conn);
   assert(r >= 0);
   return (unsigned int)r;
 }
 
-MySQLStatement::MySQLStatement(MYSQL_STMT * _stmt, const std::string & _query)
+static SQLStatement::ColumnType
+getFieldType(const MYSQL_FIELD & field) {
+  bool is_binary = field.charsetnr == 63;
+  switch (field.type) {
+  case MYSQL_TYPE_TINY:
+  case MYSQL_TYPE_SHORT:
+  case MYSQL_TYPE_INT24:
+  case MYSQL_TYPE_YEAR:
+    return SQLStatement::INT;
+  case MYSQL_TYPE_LONG:
+    return field.flags & UNSIGNED_FLAG ? SQLStatement::INT64 : SQLStatement::INT;
+  case MYSQL_TYPE_LONGLONG:
+  case MYSQL_TYPE_BIT:
+    return SQLStatement::INT64;
+  case MYSQL_TYPE_FLOAT:
+  case MYSQL_TYPE_DOUBLE:
+    return SQLStatement::DOUBLE;
+  case MYSQL_TYPE_DATE:
+  case MYSQL_TYPE_TIME:
+  case MYSQL_TYPE_DATETIME:
+  case MYSQL_TYPE_TIMESTAMP:
+  case MYSQL_TYPE_NEWDATE:
+    return SQLStatement::DATETIME;
+  case MYSQL_TYPE_TINY_BLOB:
+  case MYSQL_TYPE_MEDIUM_BLOB:
+  case MYSQL_TYPE_LONG_BLOB:
+  case MYSQL_TYPE_BLOB:
+  case MYSQL_TYPE_VAR_STRING:
+  case MYSQL_TYPE_STRING:
+  case MYSQL_TYPE_VARCHAR:
+    return is_binary ? SQLStatement::BLOB : SQLStatement::TEXT;
+  case MYSQL_TYPE_GEOMETRY:
+    return SQLStatement::BLOB;
+  default:
+    return SQLStatement::TEXT;
+  }
+}
+
+MySQLWatchdog::~MySQLWatchdog() {
+  {
+    lock_guard<std::mutex> guard(mutex);
+    is_stopping = true;
+  }
+  cond.notify_all();
+  if (thread.joinable()) thread.join();
+}
+
+void
+MySQLWatchdog::setThreadId(unsigned long _thread_id) {
+  lock_guard<std::mutex> guard(mutex);
+  thread_id = _thread_id;
+}
+
+void
+MySQLWatchdog::arm(std::chrono::milliseconds timeout) {
+  lock_guard<std::mutex> guard(mutex);
+  deadline = chrono::steady_clock::now() + timeout;
+  is_armed = true;
+  has_fired = false;
+  if (!thread.joinable()) {
+    thread = std::thread([this] { run(); });
+  }
+  cond.notify_all();
+}
+
+// A KILL in progress holds the mutex, so it has finished when this returns
+bool
+MySQLWatchdog::disarm() {
+  lock_guard<std::mutex> guard(mutex);
+  is_armed = false;
+  bool r = has_fired;
+  has_fired = false;
+  return r;
+}
+
+void
+MySQLWatchdog::cancel() {
+  lock_guard<std::mutex> guard(mutex);
+  kill();
+}
+
+// Called with the mutex held
+void
+MySQLWatchdog::kill() {
+  if (!thread_id) return;
+  if (!side) {
+    side = make_unique<MySQL>();
+    if (!side->connect(host_name, port, user_name, password, "", options)) {
+      side.reset();
+      return;
+    }
+  }
+  try {
+    side->execute(("KILL QUERY " + to_string(thread_id)).c_str());
+  } catch (SQLException &) {
+    // reconnected on the next kill
+    side.reset();
+  }
+}
+
+void
+MySQLWatchdog::run() {
+  unique_lock<std::mutex> lock(mutex);
+  while (!is_stopping) {
+    if (!is_armed) {
+      cond.wait(lock);
+    } else if (chrono::steady_clock::now() >= deadline) {
+      kill();
+      has_fired = true;
+      is_armed = false;
+    } else {
+      cond.wait_until(lock, deadline);
+    }
+  }
+}
+
+MySQLStatement::MySQLStatement(MYSQL_STMT * _stmt, const std::string & _query, const std::vector<std::string> & parameter_names, std::shared_ptr<MemoryTracker> tracker)
   : SQLStatement(_query),
     stmt(_stmt)
 {
   assert(stmt);
+
   num_bound_variables = mysql_stmt_param_count(stmt);
 
-  for (unsigned int i = 0; i < MYSQL_MAX_BOUND_VARIABLES; i++) {
-    bind_ptr[i] = 0;
+  if (tracker) {
+    // the bind arrays are part of the statement, but only the slots of the
+    // bound parameters in the bind buffer are ever written
+    unsigned int num_slots = num_bound_variables < MYSQL_MAX_BOUND_VARIABLES ? num_bound_variables : MYSQL_MAX_BOUND_VARIABLES;
+    statement_memory = sizeof(MySQLStatement) - sizeof(bind_buffer) + num_slots * MYSQL_BIND_BUFFER_SIZE;
+    try {
+      tracker->add(statement_memory);
+    } catch (...) {
+      mysql_stmt_close(stmt);
+      throw;
+    }
+    setMemoryTracker(tracker);
+    // needed for estimating the size of stored results
+    my_bool update_max_length = 1;
+    mysql_stmt_attr_set(stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
+  }
+
+  for (unsigned int i = 0; i < parameter_names.size(); i++) {
+    addNamedParameter(parameter_names[i], i + 1);
+  }
+
+  memset(bind_ptr, 0, sizeof(bind_ptr));
+
+  MYSQL_RES * meta = mysql_stmt_result_metadata(stmt);
+  if (meta) {
+    unsigned int num_fields = mysql_num_fields(meta);
+    if (num_fields > MYSQL_MAX_BOUND_VARIABLES) num_fields = MYSQL_MAX_BOUND_VARIABLES;
+    MYSQL_FIELD * fields = mysql_fetch_fields(meta);
+    columns.resize(num_fields);
+    for (unsigned int i = 0; i < num_fields; i++) {
+      columns[i].name = fields[i].name;
+      columns[i].type = getFieldType(fields[i]);
+      columns[i].size = fields[i].length;
+    }
+    mysql_free_result(meta);
   }
 
   reset();
@@ -137,43 +403,123 @@ MySQLStatement::~MySQLStatement() {
     mysql_stmt_free_result(stmt);
     mysql_stmt_close(stmt);
   }
-  for (unsigned int i = 0; i < MYSQL_MAX_BOUND_VARIABLES; i++) {
-    char * ptr = bind_ptr[i];
-    if (ptr) delete[] ptr;
+  freeLargeBindBuffers();
+  releaseResultMemory();
+  if (getMemoryTracker()) getMemoryTracker()->remove(statement_memory);
+}
+
+void
+MySQLStatement::releaseResultMemory() {
+  if (result_memory) {
+    getMemoryTracker()->remove(result_memory);
+    result_memory = 0;
+  }
+}
+
+// Estimates the memory of a stored result from the longest value of each
+// column and the row count
+size_t
+MySQLStatement::getStoredResultSize() {
+  size_t row_size = 0;
+  MYSQL_RES * meta = mysql_stmt_result_metadata(stmt);
+  if (meta) {
+    unsigned int num_fields = mysql_num_fields(meta);
+    MYSQL_FIELD * fields = mysql_fetch_fields(meta);
+    for (unsigned int i = 0; i < num_fields; i++) {
+      row_size += fields[i].max_length + 1;
+    }
+    mysql_free_result(meta);
+  }
+  return (size_t)mysql_stmt_num_rows(stmt) * (row_size + 2 * sizeof(void *));
+}
+
+// Size of the current row in the client's fetch buffer
+size_t
+MySQLStatement::getRowSize() const {
+  size_t size = 0;
+  for (unsigned int i = 0; i < columns.size(); i++) {
+    size += bind_length[i] + 1;
+  }
+  return size;
+}
+
+const char *
+MySQLStatement::getErrorMessage(SQLException::ErrorType type) {
+  if (type == SQLException::RESOURCE_LIMIT) return "Result exceeds the memory limit";
+  return mysql_stmt_error(stmt);
+}
+
+void
+MySQLStatement::freeLargeBindBuffers() {
+  for (unsigned int i = 0; i < num_bound_variables; i++) {
+    large_buffer_s & b = bind_ptr[i];
+    if (b.ptr) {
+      b.resource->deallocate(b.ptr, b.size);
+      if (bind_data[i].buffer == b.ptr) bind_data[i].buffer = 0;
+      b.ptr = 0;
+    }
   }
 }
 
 unsigned int
 MySQLStatement::execute() {
+  SQLStatus<unsigned int> r = tryExecute();
+  if (!r) {
+    throw SQLException(r.getError(), getErrorMessage(r.getError()), getQuery());
+  }
+  return r.getValue();
+}
+
+// Large bind copies are released after every execution so that a
+// per-request memory resource is not referenced by the statement afterwards
+SQLStatus<unsigned int>
+MySQLStatement::tryExecute() {
+  SQLStatus<unsigned int> r = executeQuery();
+  freeLargeBindBuffers();
+  return r;
+}
+
+SQLStatus<unsigned int>
+MySQLStatement::executeQuery() {
   is_query_executed = true;
-  has_result_set = false;
+  has_result_set = is_streaming = false;
+  releaseResultMemory();
+
+  // large values must be bound again after the previous execution
+  for (unsigned int i = 0; i < num_bound_variables; i++) {
+    if (!bind_data[i].buffer && bind_data[i].buffer_length > MYSQL_BIND_BUFFER_SIZE) {
+      return SQLException::BIND_FAILED;
+    }
+  }
   
   if (mysql_stmt_bind_param(stmt, bind_data) != 0) {
-    throw SQLException(SQLException::EXECUTE_FAILED, mysql_stmt_error(stmt), getQuery());
+    return SQLException::EXECUTE_FAILED;
+  }
+
+  if (!sendLongData()) {
+    return SQLException::EXECUTE_FAILED;
   }
   
-  // Fetch result set meta information
-  MYSQL_RES * prepare_meta_result = mysql_stmt_result_metadata(stmt);
-  
+  // the deadline covers the execution on the server and the transfer of
+  // the results
+  has_deadline = watchdog && getTimeout().count() > 0;
+  if (has_deadline) deadline = chrono::steady_clock::now() + getTimeout();
+  bool is_armed = armWatchdog();
   if (mysql_stmt_execute(stmt) != 0) {
-    throw SQLException(SQLException::EXECUTE_FAILED, mysql_stmt_error(stmt), getQuery());
+    return getStatementError(is_armed && watchdog->disarm());
   }
   
   rows_affected = mysql_stmt_affected_rows(stmt);
   last_insert_id = mysql_stmt_insert_id(stmt);
   
-  cerr << "rows affected = " << rows_affected << ", last_insert_id = " << last_insert_id << "\n";
-  
-  // NULL if no metadata / results
-  if (prepare_meta_result) {
-    // Get total columns in the query
-    num_bound_variables = mysql_num_fields(prepare_meta_result);
-    mysql_free_result(prepare_meta_result);
+  // result metadata has been read at prepare
+  if (!columns.empty()) {
+    unsigned int num_fields = columns.size();
 
     // reserve varibles if larger than MAX
-    memset(bind_data, 0, num_bound_variables * sizeof(MYSQL_BIND));
+    memset(bind_data, 0, num_fields * sizeof(MYSQL_BIND));
     
-    for (unsigned int i = 0; i < num_bound_variables; i++) {
+    for (unsigned int i = 0; i < num_fields; i++) {
       bind_length[i] = 0;
       
       // bind[i].buffer_type = MYSQL_TYPE_STRING;
@@ -185,37 +531,86 @@ MySQLStatement::execute() {
     }
     
     /* Bind the result buffers */
-    if (mysql_stmt_bind_result(stmt, bind_data) || mysql_stmt_store_result(stmt)) {
-      for (unsigned int i = 0; i < num_bound_variables; i++) {
-	if (bind_ptr[i]) {
-	  delete[] bind_ptr[i];
-	  bind_ptr[i] = 0;
-	}
-      }
-      throw SQLException(SQLException::EXECUTE_FAILED, mysql_stmt_error(stmt), getQuery());
+    if (mysql_stmt_bind_result(stmt, bind_data)) {
+      if (is_armed) watchdog->disarm();
+      return SQLException::EXECUTE_FAILED;
     }
-    
-    for (unsigned int i = 0; i < num_bound_variables; i++) {
-      if (bind_ptr[i]) {
-	delete[] bind_ptr[i];
-	bind_ptr[i] = 0;
+
+    // Results are stored and counted once their size is known. Rows are
+    // fetched from the server one at a time instead when the soft limit has
+    // been reached or a single row could exceed the memory that is left.
+    MemoryTracker * tracker = getMemoryTracker();
+    if (tracker) {
+      size_t max_row_size = 0;
+      for (auto & c : columns) max_row_size += c.size + 1;
+      is_streaming = tracker->isOverSoftLimit() || max_row_size > tracker->getAvailable();
+    }
+    if (!is_streaming) {
+      int r = mysql_stmt_store_result(stmt);
+      bool has_fired = is_armed && watchdog->disarm();
+      is_armed = false;
+      if (r != 0) {
+	return getStatementError(has_fired);
+      }
+      if (tracker) {
+	size_t size = getStoredResultSize();
+	try {
+	  tracker->add(size);
+	} catch (SQLException &) {
+	  mysql_stmt_free_result(stmt);
+	  return SQLException::RESOURCE_LIMIT;
+	}
+	result_memory = size;
       }
     }
     
     has_result_set = true;
   }
 
+  // a streamed result is killed if the deadline passed before the first fetch
+  if (is_armed && watchdog->disarm() && has_result_set) {
+    mysql_stmt_free_result(stmt);
+    has_result_set = false;
+    return SQLException::QUERY_TIMED_OUT;
+  }
+  
   return rows_affected;
 }
 
+// Arms the watchdog for the time left of the execution
+bool
+MySQLStatement::armWatchdog() {
+  if (!has_deadline) return false;
+  auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+  watchdog->arm(left.count() > 0 ? left : chrono::milliseconds(0));
+  return true;
+}
+
+// A query killed by the watchdog can fail with any error depending on
+// where the transfer was interrupted
+SQLException::ErrorType
+MySQLStatement::getStatementError(bool has_fired) {
+  SQLException::ErrorType type = getErrorType(mysql_stmt_errno(stmt));
+  return has_fired ? SQLException::QUERY_TIMED_OUT : type;
+}
+
+void
+MySQLStatement::cancel() {
+  if (watchdog) watchdog->cancel();
+}
+
 void
 MySQLStatement::reset() {
   SQLStatement::reset();
-  
+
+  if (has_result_set) mysql_stmt_free_result(stmt);
+  releaseResultMemory();
   results_available = false;
   rows_affected = 0;
   is_query_executed = false;
-  has_result_set = false;
+  has_result_set = is_streaming = false;
+  long_data.clear();
+  freeLargeBindBuffers();
   
   memset(bind_data, 0, num_bound_variables * sizeof(MYSQL_BIND));
   for (unsigned int i = 0; i < num_bound_variables; i++) {
@@ -226,27 +621,76 @@ MySQLStatement::reset() {
   // no need to reset. just rebind parameter and execute again. not tested though
 }
 
+// Streams the values bound with bindStream() in chunks that fit into the
+// parameter's own bind buffer
+bool
+MySQLStatement::sendLongData() {
+  for (auto & d : long_data) {
+    char * buffer = &bind_buffer[d.index * MYSQL_BIND_BUFFER_SIZE];
+    size_t remaining = d.len;
+    while (remaining && *d.input) {
+      d.input->read(buffer, remaining < MYSQL_BIND_BUFFER_SIZE ? remaining : MYSQL_BIND_BUFFER_SIZE);
+      size_t n = (size_t)d.input->gcount();
+      if (!n) break;
+      if (mysql_stmt_send_long_data(stmt, d.index, buffer, n) != 0) {
+	long_data.clear();
+	return false;
+      }
+      remaining -= n;
+    }
+  }
+  long_data.clear();
+  return true;
+}
+
 bool
 MySQLStatement::next() {
+  SQLStatus<bool> r = tryNext();
+  if (!r) {
+    throw SQLException(r.getError(), getErrorMessage(r.getError()), getQuery());
+  }
+  return r.getValue();
+}
+
+SQLStatus<bool>
+MySQLStatement::tryNext() {
   assert(stmt);
   
   results_available = false;
   rows_affected = 0;
   
   if (!is_query_executed) {
-    execute();    
+    SQLStatus<unsigned int> r = tryExecute();
+    if (!r) return r.getError();
   }
   
   if (has_result_set) {
+    // streamed rows are read from the server during the fetch
+    bool is_armed = is_streaming && armWatchdog();
     int r = mysql_stmt_fetch(stmt);
-        
+    bool has_fired = is_armed && watchdog->disarm();
+    
     if (r == 0) {
       results_available = true;
     } else if (r == MYSQL_NO_DATA) {
     } else if (r == MYSQL_DATA_TRUNCATED) {
       results_available = true;
     } else if (r) {
-      throw SQLException(SQLException::EXECUTE_FAILED, mysql_stmt_error(stmt), getQuery());
+      return getStatementError(has_fired);
+    }
+
+    if (is_streaming) {
+      size_t size = results_available ? getRowSize() : 0;
+      if (size > result_memory) {
+	try {
+	  getMemoryTracker()->add(size - result_memory);
+	} catch (SQLException &) {
+	  return SQLException::RESOURCE_LIMIT;
+	}
+      } else {
+	getMemoryTracker()->remove(result_memory - size);
+      }
+      result_memory = size;
     }
   }
   
@@ -309,6 +753,124 @@ MySQLStatement::bind(const void * data, size_t len, bool is_defined) {
   return bindData(MYSQL_TYPE_BLOB, data, len, is_defined);
 }
 
+MySQLStatement &
+MySQLStatement::bindStream(std::istream & input, size_t len, bool is_defined) {
+  if (!is_defined) {
+    return bindData(MYSQL_TYPE_BLOB, 0, 0, false);
+  }
+  unsigned int index = getNextBindIndex() - 1;
+  if (index >= num_bound_variables) {
+    throw SQLException(SQLException::BAD_BIND_INDEX, "", getQuery());
+  }
+  bind_data[index].buffer_type = MYSQL_TYPE_BLOB;
+  bind_data[index].buffer = 0;
+  bind_data[index].buffer_length = 0;
+  bind_data[index].is_unsigned = false;
+  bind_data[index].is_null = &is_not_null;
+  long_data.push_back({ index, &input, len });
+  return *this;
+}
+
+void
+MySQLStatement::bindRow(const field_s * fields, unsigned int num_fields) {
+  for (unsigned int i = 0; i < num_fields; i++) {
+    const void * ptr = fields[i].ptr;
+    switch (fields[i].type) {
+    case FIELD_INT: bindData(MYSQL_TYPE_LONG, ptr, sizeof(int)); break;
+    case FIELD_UINT: bindData(MYSQL_TYPE_LONG, ptr, sizeof(unsigned int), true, true); break;
+    case FIELD_INT64: bindData(MYSQL_TYPE_LONGLONG, ptr, sizeof(long long)); break;
+    case FIELD_DOUBLE: bindData(MYSQL_TYPE_DOUBLE, ptr, sizeof(double)); break;
+    case FIELD_BOOL:
+      {
+	int a = *(const bool *)ptr ? 1 : 0;
+	bindData(MYSQL_TYPE_LONG, &a, sizeof(a));
+      }
+      break;
+    case FIELD_TEXT:
+      {
+	const std::string & s = *(const std::string *)ptr;
+	bindData(MYSQL_TYPE_STRING, s.data(), s.size());
+      }
+      break;
+    case FIELD_BLOB:
+      {
+	const ustring & s = *(const ustring *)ptr;
+	bindData(MYSQL_TYPE_BLOB, s.data(), s.size());
+      }
+      break;
+    }
+  }
+}
+
+void
+MySQLStatement::fetchColumn(int column_index, enum_field_types buffer_type, void * buffer, unsigned long len, bool is_unsigned) {
+  long unsigned int dummy1;
+  my_bool dummy2;
+  MYSQL_BIND b;
+  memset(&b, 0, sizeof(MYSQL_BIND));
+  b.buffer_type = buffer_type;
+  b.buffer = buffer;
+  b.buffer_length = len;
+  b.length = &dummy1;
+  b.is_null = &dummy2;
+  b.is_unsigned = is_unsigned;
+  if (mysql_stmt_fetch_column(stmt, &b, column_index, 0) != 0) {
+    throw SQLException(SQLException::GET_FAILED, mysql_stmt_error(stmt), getQuery());
+  }
+}
+
+// Fetches each column straight into the struct member
+void
+MySQLStatement::fetchRow(const field_s * fields, unsigned int num_fields) {
+  assert(stmt);
+  if (num_fields > columns.size()) {
+    throw SQLException(SQLException::BAD_COLUMN_INDEX, "", getQuery());
+  }
+  for (unsigned int i = 0; i < num_fields; i++) {
+    void * ptr = fields[i].ptr;
+    bool is_empty = bind_is_null[i] || !bind_length[i];
+    switch (fields[i].type) {
+    case FIELD_INT:
+      *(int *)ptr = 0;
+      if (!is_empty) fetchColumn(i, MYSQL_TYPE_LONG, ptr, sizeof(int));
+      break;
+    case FIELD_UINT:
+      *(unsigned int *)ptr = 0;
+      if (!is_empty) fetchColumn(i, MYSQL_TYPE_LONG, ptr, sizeof(unsigned int), true);
+      break;
+    case FIELD_INT64:
+      *(long long *)ptr = 0;
+      if (!is_empty) fetchColumn(i, MYSQL_TYPE_LONGLONG, ptr, sizeof(long long));
+      break;
+    case FIELD_DOUBLE:
+      *(double *)ptr = 0;
+      if (!is_empty) fetchColumn(i, MYSQL_TYPE_DOUBLE, ptr, sizeof(double));
+      break;
+    case FIELD_BOOL:
+      {
+	int a = 0;
+	if (!is_empty) fetchColumn(i, MYSQL_TYPE_LONG, &a, sizeof(a));
+	*(bool *)ptr = a != 0;
+      }
+      break;
+    case FIELD_TEXT:
+      {
+	std::string & s = *(std::string *)ptr;
+	s.resize(is_empty ? 0 : bind_length[i]);
+	if (!s.empty()) fetchColumn(i, MYSQL_TYPE_STRING, &s[0], s.size());
+      }
+      break;
+    case FIELD_BLOB:
+      {
+	ustring & s = *(ustring *)ptr;
+	s.resize(is_empty ? 0 : bind_length[i]);
+	if (!s.empty()) fetchColumn(i, MYSQL_TYPE_BLOB, &s[0], s.size());
+      }
+      break;
+    }
+  }
+}
+
 int
 MySQLStatement::getInt(int column_index) {
   if (column_index < 0 || column_index >= MYSQL_MAX_BOUND_VARIABLES) throw SQLException(SQLException::BAD_COLUMN_INDEX, "", getQuery());
@@ -434,31 +996,19 @@ MySQLStatement::getText(int column_index) {
   if (bind_is_null[column_index]) {
 
   } else if (len) {
-    char * tmp = new char[len];
-    
-    long unsigned int dummy1;
-    my_bool dummy2;
-    MYSQL_BIND b;
-    memset(&b, 0, sizeof(MYSQL_BIND));
-    b.buffer_type = MYSQL_TYPE_STRING;
-    b.buffer = tmp;  
-    b.buffer_length = len;
-    b.length = &dummy1; 
-    b.is_null = &dummy2;
-    
-    if (mysql_stmt_fetch_column(stmt, &b, column_index, 0) != 0) {
-      delete[] tmp;
-      throw SQLException(SQLException::GET_FAILED, mysql_stmt_error(stmt), getQuery());
-    }
-	
-    s = string(tmp, len);
-    
-    delete[] tmp;
+    s.resize(len);
+    readBlob(column_index, 0, &s[0], len);
   }
   
   return s;
 }
 
+bool
+MySQLStatement::isNull(int column_index) {
+  if (column_index < 0 || column_index >= MYSQL_MAX_BOUND_VARIABLES) throw SQLException(SQLException::BAD_COLUMN_INDEX, "", getQuery());
+  return !results_available || bind_is_null[column_index];
+}
+
 ustring
 MySQLStatement::getBlob(int column_index) {
   if (column_index < 0 || column_index >= MYSQL_MAX_BOUND_VARIABLES) throw SQLException(SQLException::BAD_COLUMN_INDEX, "", getQuery());
@@ -472,29 +1022,48 @@ MySQLStatement::getBlob(int column_index) {
   if (bind_is_null[column_index]) {
 
   } else if (len) {
-    char * tmp = new char[len];
-    
-    long unsigned int dummy1;
-    my_bool dummy2;
-    MYSQL_BIND b;
+    s.resize(len);
+    readBlob(column_index, 0, &s[0], len);
+  }
 
-    memset(&b, 0, sizeof(MYSQL_BIND));
-    b.buffer_type = MYSQL_TYPE_BLOB;
-    b.buffer = tmp;  
-    b.buffer_length = len;
-    b.length = &dummy1; 
-    b.is_null = &dummy2;
-    
-    if (mysql_stmt_fetch_column(stmt, &b, column_index, 0) != 0) {
-      delete[] tmp;
-      throw SQLException(SQLException::GET_FAILED, mysql_stmt_error(stmt), getQuery());
-    }
-    s = ustring((unsigned char *)tmp, len);
+  return s;
+}
+
+size_t
+MySQLStatement::getBlobSize(int column_index) {
+  if (column_index < 0 || column_index >= MYSQL_MAX_BOUND_VARIABLES) throw SQLException(SQLException::BAD_COLUMN_INDEX, "", getQuery());
+  return bind_is_null[column_index] ? 0 : bind_length[column_index];
+}
+
+// The value is already in the client's row buffer, so chunks only save the
+// copy into a buffer of the full size
+size_t
+MySQLStatement::readBlob(int column_index, size_t offset, void * buffer, size_t len) {
+  if (column_index < 0 || column_index >= MYSQL_MAX_BOUND_VARIABLES) throw SQLException(SQLException::BAD_COLUMN_INDEX, "", getQuery());
+
+  assert(stmt);
+
+  size_t total = bind_is_null[column_index] ? 0 : bind_length[column_index];
+  if (offset >= total) {
+    return 0;
+  }
+  if (len > total - offset) len = total - offset;
+
+  long unsigned int dummy1;
+  my_bool dummy2;
+  MYSQL_BIND b;
+  memset(&b, 0, sizeof(MYSQL_BIND));
+  b.buffer_type = MYSQL_TYPE_BLOB;
+  b.buffer = buffer;
+  b.buffer_length = len;
+  b.length = &dummy1;
+  b.is_null = &dummy2;
     
-    delete[] tmp;
+  if (mysql_stmt_fetch_column(stmt, &b, column_index, offset) != 0) {
+    throw SQLException(SQLException::GET_FAILED, mysql_stmt_error(stmt), getQuery());
   }
 
-  return s;
+  return len;
 }
 
 MySQLStatement &
@@ -508,10 +1077,19 @@ MySQLStatement::bindData(enum_field_types buffer_type, const void * ptr, unsigne
   if (size <= MYSQL_BIND_BUFFER_SIZE) {
     buffer = &bind_buffer[index * MYSQL_BIND_BUFFER_SIZE];
   } else {
-    delete[] bind_ptr[index];
-    buffer = bind_ptr[index] = new char[size];
+    large_buffer_s & b = bind_ptr[index];
+    if (b.ptr && (b.size < size || b.resource != getBufferResource())) {
+      b.resource->deallocate(b.ptr, b.size);
+      b.ptr = 0;
+    }
+    if (!b.ptr) {
+      b.resource = getBufferResource();
+      b.ptr = (char *)b.resource->allocate(size);
+      b.size = size;
+    }
+    buffer = b.ptr;
   }
-  memcpy(buffer, ptr, size);
+  if (size) memcpy(buffer, ptr, size);
   bind_data[index].buffer_type = buffer_type;
   bind_data[index].buffer = buffer;
   bind_data[index].buffer_length = size;
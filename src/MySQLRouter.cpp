@@ -0,0 +1,272 @@
+#include "MySQLRouter.h"
+
+#include <cctype>
+
+using namespace std;
+using namespace sqldb;
+
+MySQLRouter::MySQLRouter(std::shared_ptr<MySQL> _primary, std::vector<std::shared_ptr<MySQL> > _replicas, const MySQLRouterOptions & _options, std::shared_ptr<MySQLReplicaLoad> _load)
+  : primary(_primary),
+    replicas(std::move(_replicas)),
+    options(_options),
+    load(_load),
+    replica_gtid(replicas.size())
+{
+  if (!load) {
+    load = make_shared<MySQLReplicaLoad>(replicas.size());
+  } else if (load->size() != replicas.size()) {
+    throw SQLException(SQLException::DATABASE_MISUSE, "Replica count does not match load counters");
+  }
+  if (options.consistency == MySQLRouterOptions::READ_YOUR_WRITES_GTID) {
+    // without the GTIDs reads would silently go to replicas that lag behind
+    if (!MySQL::hasGTIDTracking()) {
+      throw SQLException(SQLException::DATABASE_MISUSE, "READ_YOUR_WRITES_GTID requires a MySQL 5.7 or later client library");
+    }
+    // the GTID of each commit is then returned in the OK packet
+    primary->execute("SET SESSION session_track_gtids = OWN_GTID");
+  }
+}
+
+bool
+MySQLRouter::isReadQuery(const std::string & query) {
+  if (!SQLStatement::isSelect(query)) return false;
+
+  // locking reads must run on the primary
+  string upper;
+  for (char c : query) upper += (char)toupper((unsigned char)c);
+  return upper.find("FOR UPDATE") == string::npos &&
+    upper.find("FOR SHARE") == string::npos &&
+    upper.find("LOCK IN SHARE MODE") == string::npos &&
+    upper.find("GET_LOCK") == string::npos;
+}
+
+size_t
+MySQLRouter::route(bool is_read) {
+  if (!is_read || in_transaction || replicas.empty()) return 0;
+
+  if (has_written && options.consistency == MySQLRouterOptions::READ_YOUR_WRITES_WINDOW) {
+    if (chrono::steady_clock::now() - last_write < chrono::milliseconds(options.sticky_window_ms)) {
+      return 0;
+    }
+  }
+
+  size_t replica = 0;
+  if (options.balancing == MySQLRouterOptions::LEAST_OUTSTANDING) {
+    // ties are broken round robin so that idle replicas share the load
+    unsigned int best = 0;
+    for (size_t i = 0; i < replicas.size(); i++) {
+      size_t j = (next_replica + i) % replicas.size();
+      unsigned int n = (*load)[j];
+      if (!i || n < best) {
+	best = n;
+	replica = j;
+      }
+    }
+    next_replica = (replica + 1) % replicas.size();
+  } else {
+    replica = next_replica;
+    next_replica = (next_replica + 1) % replicas.size();
+  }
+
+  if (options.consistency == MySQLRouterOptions::READ_YOUR_WRITES_GTID && !last_gtid.empty() && replica_gtid[replica] != last_gtid) {
+    if (!replicas[replica]->waitForGTID(last_gtid, options.gtid_wait_timeout)) {
+      return 0;
+    }
+    replica_gtid[replica] = last_gtid;
+  }
+
+  return replica + 1;
+}
+
+void
+MySQLRouter::onWrite() {
+  if (in_transaction) {
+    has_transaction_writes = true;
+  } else {
+    recordWrite();
+  }
+}
+
+void
+MySQLRouter::recordWrite() {
+  has_written = true;
+  last_write = chrono::steady_clock::now();
+  if (options.consistency == MySQLRouterOptions::READ_YOUR_WRITES_GTID) {
+    string gtid = primary->getLastGTID();
+    if (!gtid.empty()) last_gtid = gtid;
+  }
+}
+
+std::shared_ptr<SQLStatement>
+MySQLRouter::prepare(const string & query) {
+  return make_shared<MySQLRoutedStatement>(*this, query);
+}
+
+void
+MySQLRouter::begin() {
+  primary->begin();
+  in_transaction = true;
+  has_transaction_writes = false;
+}
+
+void
+MySQLRouter::commit() {
+  in_transaction = false;
+  primary->commit();
+  if (has_transaction_writes) recordWrite();
+  has_transaction_writes = false;
+}
+
+void
+MySQLRouter::rollback() {
+  in_transaction = false;
+  has_transaction_writes = false;
+  primary->rollback();
+}
+
+void
+MySQLRouter::cancel() {
+  primary->cancel();
+  for (auto & replica : replicas) replica->cancel();
+}
+
+unsigned int
+MySQLRouter::execute(const char * query) {
+  unsigned int r = primary->execute(query);
+  if (!isReadQuery(query)) onWrite();
+  return r;
+}
+
+MySQLRoutedStatement::MySQLRoutedStatement(MySQLRouter & _router, const std::string & query)
+  : SQLStatement(query),
+    router(_router),
+    is_read(MySQLRouter::isReadQuery(query)),
+    stmts(_router.getNumReplicas() + 1)
+{
+  vector<string> parameter_names;
+  rewriteNamedParameters(getQuery(), parameter_names);
+  for (unsigned int i = 0; i < parameter_names.size(); i++) {
+    addNamedParameter(parameter_names[i], i + 1);
+  }
+
+  // prepared on one server to validate the query and read the columns
+  SQLStatement & stmt = getStatement(is_read && !router.inTransaction() && router.getNumReplicas() ? 1 : 0);
+  unsigned int num_fields = stmt.getNumFields();
+  columns.resize(num_fields);
+  for (unsigned int i = 0; i < num_fields; i++) {
+    columns[i].name = stmt.getColumnName(i);
+    columns[i].type = stmt.getColumnType(i);
+    columns[i].size = stmt.getColumnSize(i);
+  }
+}
+
+MySQLRoutedStatement::~MySQLRoutedStatement() {
+  release();
+}
+
+SQLStatement &
+MySQLRoutedStatement::getStatement(size_t index) {
+  if (!stmts[index]) {
+    stmts[index] = router.getServer(index).prepare(getQuery());
+    stmts[index]->setTimeout(getTimeout());
+  }
+  return *stmts[index];
+}
+
+SQLStatement &
+MySQLRoutedStatement::getTarget() {
+  if (!target) {
+    throw SQLException(SQLException::GET_FAILED, "Statement has not been executed", getQuery());
+  }
+  return *target;
+}
+
+void
+MySQLRoutedStatement::setTimeout(std::chrono::milliseconds _timeout) {
+  SQLStatement::setTimeout(_timeout);
+  for (auto & stmt : stmts) {
+    if (stmt) stmt->setTimeout(_timeout);
+  }
+}
+
+// The target is read without synchronization, so all servers are cancelled
+void
+MySQLRoutedStatement::cancel() {
+  for (auto & stmt : stmts) {
+    if (stmt) stmt->cancel();
+  }
+}
+
+// Streams cannot be replayed if the statement moves to another server
+MySQLRoutedStatement &
+MySQLRoutedStatement::bindStream(std::istream &, size_t, bool) {
+  throw SQLException(SQLException::BIND_FAILED, "Streams cannot be bound to routed statements", getQuery());
+}
+
+void
+MySQLRoutedStatement::release() {
+  if (is_outstanding) {
+    router.getLoad()[target_index - 1]--;
+    is_outstanding = false;
+  }
+}
+
+unsigned int
+MySQLRoutedStatement::start() {
+  release();
+  target_index = router.route(is_read);
+  target = &getStatement(target_index);
+  target->reset();
+  for (unsigned int i = 0; i < binds.size(); i++) {
+    if (binds[i]) {
+      target->setBindIndex(i + 1);
+      binds[i](*target);
+    }
+  }
+
+  unsigned int r;
+  if (target_index) {
+    // the replica counts as busy until the result has been read to the end
+    // or the statement is reset
+    router.getLoad()[target_index - 1]++;
+    is_outstanding = true;
+    try {
+      r = target->execute();
+    } catch (...) {
+      release();
+      throw;
+    }
+    if (columns.empty()) release();
+  } else {
+    r = target->execute();
+    if (!is_read) router.onWrite();
+  }
+  is_executed = true;
+  return r;
+}
+
+unsigned int
+MySQLRoutedStatement::execute() {
+  return start();
+}
+
+bool
+MySQLRoutedStatement::next() {
+  if (!is_executed) start();
+  try {
+    results_available = target->next();
+  } catch (...) {
+    release();
+    throw;
+  }
+  if (!results_available) release();
+  return results_available;
+}
+
+void
+MySQLRoutedStatement::reset() {
+  SQLStatement::reset();
+  release();
+  binds.clear();
+  is_executed = results_available = false;
+}
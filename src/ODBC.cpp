@@ -1,44 +1,50 @@
 #include "ODBC.h"
 
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
-#include <sqlext.h>
+
+#include "SQLException.h"
 
 using namespace std;
 using namespace sqldb;
 
-ODBCStatement::ODBCStatement(stmt)
-  : stmt(_stmt) {
-  
-}
+static string
+createErrorString(SQLSMALLINT handle_type, SQLHANDLE handle, string * sqlstate = 0) {
+  if (!handle) return "Invalid handle";
 
-ODBCStatement::~ODBCStatement() {
-  SQLFreeHandle(SQL_HANDLE_STMT, stmt);
-}
+  SQLCHAR state[6];
+  SQLINTEGER native_error = 0;
+  SQLCHAR msg[512];
+  SQLSMALLINT msg_len = 0;
 
-void
-ODBCStatement::clearBoundData() {
-  while (!bound_data.empty()) {
-    query_data & d = bound_data.back();
-    delete[] d.ptr;
-    bound_data.pop_back();
+  memset(state, 0, sizeof(state));
+  memset(msg, 0, sizeof(msg));
+
+  SQLRETURN r = SQLGetDiagRec(handle_type, handle, 1, state, &native_error, msg, sizeof(msg), &msg_len);
+  if (!SQL_SUCCEEDED(r)) {
+    return "";
   }
+  if (sqlstate) *sqlstate = (const char *)state;
+  return (const char *)msg;
 }
 
-unsigned int
-ODBCStatement::getAffectedRows() {
-  if (!stmt) return false;
-  SQLLEN count;
-  if (SQL_SUCCEEDED(SQLRowCount(stmt, &count))) {
-    if (count >= 0) {
-      return (unsigned int)count;
-    } else {
-      fprintf(stderr, "SQLRowCount returned %d\n", count);
+static void
+throwError(SQLException::ErrorType type, SQLSMALLINT handle_type, SQLHANDLE handle, const string & query) {
+  string sqlstate;
+  string errmsg = createErrorString(handle_type, handle, &sqlstate);
+  if (type == SQLException::EXECUTE_FAILED) {
+    if (sqlstate.compare(0, 2, "23") == 0) {
+      type = SQLException::CONSTRAINT_VIOLATION;
+    } else if (sqlstate == "HYT00" || sqlstate == "HYT01") {
+      type = SQLException::QUERY_TIMED_OUT;
+    } else if (sqlstate == "HY008") {
+      type = SQLException::QUERY_CANCELLED;
     }
-  } else {
-    error_string = CreateErrorString(SQL_HANDLE_STMT, stmt);
-    fprintf(stderr, "SQLRowCount failed: %s\n", error_string.c_str()); 
   }
-  return 0;
+  throw SQLException(type, errmsg, query);
 }
 
 ODBC::ODBC(const string & _dsn, const string & _username, const string & _password)
@@ -46,7 +52,6 @@ ODBC::ODBC(const string & _dsn, const string & _username, const string & _passwo
     username(_username),
     password(_password)
 {
-  nts = SQL_NTS;
 }
 
 ODBC::~ODBC() {
@@ -55,208 +60,884 @@ ODBC::~ODBC() {
 
 bool
 ODBC::disconnect() {
-  clearBoundData();
   if (dbc) {
     SQLDisconnect(dbc);
     SQLFreeHandle(SQL_HANDLE_DBC, dbc);
+    dbc = 0;
   }
   if (env) {
     SQLFreeHandle(SQL_HANDLE_ENV, env);
+    env = 0;
   }
   return true;
 }
 
 bool
 ODBC::connect() {
-  // retcode = SQLAllocEnv(&henv);
+  disconnect();
+
   if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &env))) {
     error_string = "Failed to create ODBC environment";
     cerr << "ODBC connect failed: " << error_string << endl;
     return false;
   }
 
-  if (!SQL_SUCCEEDED(SQLSetEnvAttr(env, SQL_ATTR_ODBC_VERSION, (void *) SQL_OV_ODBC3, 0))) {
+  if (!SQL_SUCCEEDED(SQLSetEnvAttr(env, SQL_ATTR_ODBC_VERSION, (SQLPOINTER)SQL_OV_ODBC3, 0))) {
     error_string = "Failed to set ODBC version";
     cerr << "ODBC connect failed: " << error_string << endl;
+    disconnect();
     return false;
   }
 
-#if 0
-  if (!SQL_SUCCEEDED(SQLSetEnvAttr(env, SQL_ATTR_AUTOCOMMIT, (void *) SQL_AUTOCOMMIT_ON, 0))) {
-    error_string = "Failed to set auto commit";
-    fprintf(stderr, "ODBC connect failed: %s\n", error_string.c_str());
-    return false;
-  }
-#endif
-  
   if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_DBC, env, &dbc))) {
     error_string = "Failed to create ODBC connection handle";
     cerr << "ODBC connect failed: " << error_string << endl;
+    dbc = 0;
+    disconnect();
     return false;
   }
-  
-  string conn_str = "DSN=" + dsn + ";UID=" + username + ";PWD=" + password;
 
-  SQLCHAR tmp[256];
-  strncpy((char*)tmp, conn_str.c_str(), 256);
-  tmp[255] = 0;
+  string conn_str = dsn.find('=') != string::npos ? dsn : "DSN=" + dsn;
+  if (!username.empty()) conn_str += ";UID=" + username;
+  if (!password.empty()) conn_str += ";PWD=" + password;
 
-  cerr << "trying to connect to ODBC database, dsn = \"" << tmp << "\"\n";
-  // if (SQLConnect(dbc, dsn.c_str(), dsn.size(), "hr", SQL_NTS, "hr", SQL_NTS) != SQL_SUCCESS) {
-  if (!SQL_SUCCEEDED(SQLDriverConnect(dbc, 0, tmp, SQL_NTS, 0, 0, 0, SQL_DRIVER_NOPROMPT))) {
-    // printSQLError(2, hdbc);
-    error_string = "Failed to connect to ODBC database";
+  if (!SQL_SUCCEEDED(SQLDriverConnect(dbc, 0, (SQLCHAR *)conn_str.c_str(), SQL_NTS, 0, 0, 0, SQL_DRIVER_NOPROMPT))) {
+    error_string = createErrorString(SQL_HANDLE_DBC, dbc);
     cerr << "ODBC connect failed: " << error_string << endl;
+    disconnect();
     return false;
   }
-  
+
+  if (!SQL_SUCCEEDED(SQLGetInfo(dbc, SQL_GETDATA_EXTENSIONS, &getdata_extensions, sizeof(getdata_extensions), 0))) {
+    getdata_extensions = 0;
+  }
+
   return true;
 }
 
-std::shared_ptr<ODBCStatement>
+std::shared_ptr<SQLStatement>
 ODBC::prepare(const string & query) {
-  clearBoundData();
+  if (!dbc) {
+    throw SQLException(SQLException::PREPARE_FAILED, "Not connected", query);
+  }
+
+  std::vector<std::string> parameter_names;
+  string rewritten_query = SQLStatement::rewriteNamedParameters(query, parameter_names);
 
-  HSTMT stmt;
-  
+  SQLHSTMT stmt = 0;
   if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt))) {
-    error_string = "Failed to create statement handle";
-    cerr << "ODBC connect failed: " << error_string << endl;
-    return false;
+    throw SQLException(SQLException::PREPARE_FAILED, createErrorString(SQL_HANDLE_DBC, dbc), query);
   }
-  
-  query_data & qd = bindData(query.c_str(), query.size());
-  if (!SQL_SUCCEEDED(SQLPrepare(stmt, qd.ptr, qd.size))) {
-    fprintf(stderr, "ODBC prepare failed\n");
-    return false;
+
+  if (!SQL_SUCCEEDED(SQLPrepare(stmt, (SQLCHAR *)rewritten_query.c_str(), (SQLINTEGER)rewritten_query.size()))) {
+    string errmsg = createErrorString(SQL_HANDLE_STMT, stmt);
+    SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+    throw SQLException(SQLException::PREPARE_FAILED, errmsg, query);
   }
-  return true;
+
+  auto r = std::make_shared<ODBCStatement>(stmt, query, parameter_names);
+  r->setMemoryTracker(createStatementTracker());
+  r->setTimeout(getQueryTimeout());
+  r->setGetDataExtensions(getdata_extensions);
+  return r;
 }
 
 bool
-ODBC::Finalize() {
-#if 0
-  if (!SQL_SUCCEEDED(SQLCloseCursor(stmt))) {
-    fprintf(stderr, "ODBC close cursor failed\n");
-    return false;
+ODBC::ping() {
+  if (!dbc) return false;
+  SQLUINTEGER dead = 0;
+  if (SQL_SUCCEEDED(SQLGetConnectAttr(dbc, SQL_ATTR_CONNECTION_DEAD, &dead, 0, 0))) {
+    return dead != SQL_CD_TRUE;
   }
-#endif
-  ClearBoundData();
-  return true;
+  return false;
 }
 
-ODBC::query_data &
-ODBC::bindData(const void * ptr, size_t size) {
-  query_data d;
-  d.size = (SQLINTEGER)size;
-  d.ptr = new unsigned char[size];
-  memcpy(d.ptr, ptr, size);
-  bound_data.push_back(d);
-  return bound_data.back();
+void
+ODBC::begin() {
+  if (!dbc) return;
+  SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_OFF, 0); // disable autocommit
 }
 
-bool
-ODBC::bind(unsigned int index, unsigned int value) {
-  if (!stmt) return false;
-  query_data & qd = BindData(&value, sizeof(value));
-  if (!SQL_SUCCEEDED(SQLBindParameter(stmt, index, SQL_PARAM_INPUT, SQL_C_ULONG,
-				      SQL_INTEGER, 0, 0, qd.ptr, qd.size, &qd.size))) {
-    fprintf(stderr, "ODBC failed to bind\n");
-    return false;
+void
+ODBC::commit() {
+  if (!dbc) return;
+  if (!SQL_SUCCEEDED(SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_COMMIT))) {
+    string errmsg = createErrorString(SQL_HANDLE_DBC, dbc);
+    SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, 0); // enable autocommit
+    throw SQLException(SQLException::COMMIT_FAILED, errmsg);
   }
-  return true;
+  SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, 0); // enable autocommit
 }
 
-bool
-ODBC::bind(unsigned int index, int value) {
-  if (!stmt) return false;
-  query_data & qd = BindData(&value, sizeof(value));
-  if (!SQL_SUCCEEDED(SQLBindParameter(stmt, index, SQL_PARAM_INPUT, SQL_C_SLONG,
-				      SQL_INTEGER, 0, 0, qd.ptr, qd.size, &qd.size))) {
-    fprintf(stderr, "ODBC failed to bind\n");
-    return false;
+void
+ODBC::rollback() {
+  if (!dbc) return;
+  if (!SQL_SUCCEEDED(SQLEndTran(SQL_HANDLE_DBC, dbc, SQL_ROLLBACK))) {
+    string errmsg = createErrorString(SQL_HANDLE_DBC, dbc);
+    SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, 0); // enable autocommit
+    throw SQLException(SQLException::ROLLBACK_FAILED, errmsg);
   }
-  return true;
+  SQLSetConnectAttr(dbc, SQL_ATTR_AUTOCOMMIT, (SQLPOINTER)SQL_AUTOCOMMIT_ON, 0); // enable autocommit
 }
 
-bool
-ODBC::bind(unsigned int index, double value) {
-  if (!stmt) return false;
-  query_data & qd = BindData(&value, sizeof(value));
-  if (!SQL_SUCCEEDED(SQLBindParameter(stmt, index, SQL_PARAM_INPUT, SQL_C_DOUBLE, SQL_DOUBLE, 0, 0, qd.ptr, qd.size, &qd.size))) {
-    fprintf(stderr, "ODBC failed to bind\n");
-    return false;
+unsigned int
+ODBC::execute(const char * query) {
+  if (!dbc) {
+    throw SQLException(SQLException::EXECUTE_FAILED, "Not connected", query);
+  }
+
+  SQLHSTMT stmt = 0;
+  if (!SQL_SUCCEEDED(SQLAllocHandle(SQL_HANDLE_STMT, dbc, &stmt))) {
+    throw SQLException(SQLException::EXECUTE_FAILED, createErrorString(SQL_HANDLE_DBC, dbc), query);
+  }
+
+  SQLRETURN r = SQLExecDirect(stmt, (SQLCHAR *)query, SQL_NTS);
+  if (!SQL_SUCCEEDED(r) && r != SQL_NO_DATA) {
+    try {
+      throwError(SQLException::EXECUTE_FAILED, SQL_HANDLE_STMT, stmt, query);
+    } catch (...) {
+      SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+      throw;
+    }
+  }
+
+  SQLLEN count = 0;
+  if (!SQL_SUCCEEDED(SQLRowCount(stmt, &count)) || count < 0) {
+    count = 0;
+  }
+  SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+  return (unsigned int)count;
+}
+
+ODBCStatement::ODBCStatement(SQLHSTMT _stmt, const std::string & _query, const std::vector<std::string> & parameter_names)
+  : SQLStatement(_query),
+    stmt(_stmt)
+{
+  assert(stmt);
+
+  for (unsigned int i = 0; i < parameter_names.size(); i++) {
+    addNamedParameter(parameter_names[i], i + 1);
+  }
+
+  SQLSMALLINT num_params = 0;
+  if (!SQL_SUCCEEDED(SQLNumParams(stmt, &num_params))) {
+    num_params = 0;
+  }
+  bound_data.resize(num_params);
+  for (auto & d : bound_data) {
+    d.length.assign(1, SQL_NULL_DATA);
+  }
+
+  SQLSetStmtAttr(stmt, SQL_ATTR_PARAM_BIND_TYPE, (SQLPOINTER)SQL_PARAM_BIND_BY_COLUMN, 0);
+
+  describeColumns();
+}
+
+ODBCStatement::~ODBCStatement() {
+  if (stmt) SQLFreeHandle(SQL_HANDLE_STMT, stmt);
+}
+
+unsigned int
+ODBCStatement::execute() {
+  if (batch_rows) {
+    throw SQLException(SQLException::DATABASE_MISUSE, "Batch pending, use executeBatch()", getQuery());
+  }
+  executeRows(1);
+  return rows_affected;
+}
+
+void
+ODBCStatement::executeRows(size_t num_rows) {
+  is_query_executed = true;
+  has_result_set = false;
+  results_available = false;
+  rows_affected = 0;
+  num_result_columns = 0;
+  data_column = -1;
+  is_block_cursor = is_positioned = false;
+
+  SQLFreeStmt(stmt, SQL_CLOSE);
+
+  if (!SQL_SUCCEEDED(SQLSetStmtAttr(stmt, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER)(SQLULEN)num_rows, 0))) {
+    throwError(SQLException::EXECUTE_FAILED, SQL_HANDLE_STMT, stmt, getQuery());
+  }
+  // the driver enforces the timeout in whole seconds
+  SQLULEN timeout_seconds = (SQLULEN)((getTimeout().count() + 999) / 1000);
+  if (timeout_seconds != applied_timeout) {
+    SQLSetStmtAttr(stmt, SQL_ATTR_QUERY_TIMEOUT, (SQLPOINTER)timeout_seconds, 0);
+    applied_timeout = timeout_seconds;
+  }
+
+  // Parameters are only rebound when their arrays have moved
+  for (size_t i = 0; i < bound_data.size(); i++) {
+    query_data & d = bound_data[i];
+    if (!d.c_type) {
+      d.c_type = SQL_C_CHAR;
+      d.sql_type = SQL_VARCHAR;
+    }
+    if (d.width < 1) d.width = 1;
+    if (d.buffer.size() < num_rows * d.width) d.buffer.resize(num_rows * d.width);
+    if (d.length.size() < num_rows) d.length.resize(num_rows, SQL_NULL_DATA);
+
+    const void * ptr = d.input ? (const void *)&d : (const void *)d.buffer.data();
+    if (ptr == d.bound_ptr && d.length.data() == d.bound_length && d.width == d.bound_width) {
+      continue;
+    }
+    SQLULEN column_size = d.input ? d.input_len : d.width;
+    if (!SQL_SUCCEEDED(SQLBindParameter(stmt, i + 1, SQL_PARAM_INPUT, d.c_type, d.sql_type, column_size, 0, (SQLPOINTER)ptr, d.width, d.length.data()))) {
+      d.bound_ptr = 0;
+      throwError(SQLException::BIND_FAILED, SQL_HANDLE_STMT, stmt, getQuery());
+    }
+    d.bound_ptr = ptr;
+    d.bound_length = d.length.data();
+    d.bound_width = d.width;
+  }
+
+  SQLRETURN r = SQLExecute(stmt);
+  if (r == SQL_NEED_DATA) {
+    r = sendLongData();
+  }
+  if (!SQL_SUCCEEDED(r) && r != SQL_NO_DATA) {
+    throwError(SQLException::EXECUTE_FAILED, SQL_HANDLE_STMT, stmt, getQuery());
+  }
+
+  SQLLEN count = 0;
+  if (SQL_SUCCEEDED(SQLRowCount(stmt, &count)) && count > 0) {
+    rows_affected = (unsigned int)count;
+  }
+
+  SQLSMALLINT num_cols = 0;
+  if (SQL_SUCCEEDED(SQLNumResultCols(stmt, &num_cols)) && num_cols > 0) {
+    num_result_columns = num_cols;
+    has_result_set = true;
+    if (columns.size() != num_result_columns) {
+      describeColumns();
+    }
+    bindColumns();
+  }
+}
+
+static SQLStatement::ColumnType
+getColumnTypeFromSQLType(SQLSMALLINT sql_type) {
+  switch (sql_type) {
+  case SQL_BIT:
+  case SQL_TINYINT:
+  case SQL_SMALLINT:
+  case SQL_INTEGER:
+    return SQLStatement::INT;
+  case SQL_BIGINT:
+    return SQLStatement::INT64;
+  case SQL_REAL:
+  case SQL_FLOAT:
+  case SQL_DOUBLE:
+    return SQLStatement::DOUBLE;
+  case SQL_BINARY:
+  case SQL_VARBINARY:
+  case SQL_LONGVARBINARY:
+    return SQLStatement::BLOB;
+  case SQL_DATETIME:
+  case SQL_TYPE_DATE:
+  case SQL_TYPE_TIME:
+  case SQL_TYPE_TIMESTAMP:
+    return SQLStatement::DATETIME;
+  default:
+    return SQLStatement::TEXT;
+  }
+}
+
+// Most drivers can describe the result columns right after SQLPrepare,
+// others only after execution
+void
+ODBCStatement::describeColumns() {
+  SQLSMALLINT num_cols = 0;
+  if (!SQL_SUCCEEDED(SQLNumResultCols(stmt, &num_cols)) || num_cols <= 0) {
+    return;
+  }
+  columns.resize(num_cols);
+  column_buffers.resize(num_cols);
+  for (int i = 0; i < num_cols; i++) {
+    SQLCHAR name[256];
+    SQLSMALLINT name_len = 0, sql_type = 0, decimal_digits = 0, nullable = 0;
+    SQLULEN column_size = 0;
+    if (!SQL_SUCCEEDED(SQLDescribeCol(stmt, i + 1, name, sizeof(name), &name_len, &sql_type, &column_size, &decimal_digits, &nullable))) {
+      columns.clear();
+      column_buffers.clear();
+      return;
+    }
+    columns[i].name = (const char *)name;
+    columns[i].type = getColumnTypeFromSQLType(sql_type);
+    columns[i].size = column_size;
+    column_buffers[i].sql_type = sql_type;
+  }
+}
+
+// Binds the columns to arrays of row_array_size values so that SQLFetch
+// returns a block of rows. Long columns are left unbound and read with
+// SQLGetData from the current row of the block, which needs SQL_GD_BLOCK and
+// SQL_GD_ANY_COLUMN. Without them a long column falls back to single rows.
+void
+ODBCStatement::bindColumns() {
+  is_block_cursor = false;
+  current_row = rows_fetched = 0;
+  SQLFreeStmt(stmt, SQL_UNBIND);
+
+  bool has_block_data = (getdata_extensions & (SQL_GD_BLOCK | SQL_GD_ANY_COLUMN)) == (SQL_GD_BLOCK | SQL_GD_ANY_COLUMN);
+  bool is_bindable = row_array_size > 1 && columns.size() == num_result_columns;
+  unsigned int num_bound = 0;
+  for (unsigned int i = 0; i < num_result_columns && is_bindable; i++) {
+    column_data & c = column_buffers[i];
+    SQLULEN column_size = columns[i].size;
+    switch (c.sql_type) {
+    case SQL_BIT:
+    case SQL_TINYINT:
+    case SQL_SMALLINT:
+    case SQL_INTEGER:
+    case SQL_BIGINT:
+      c.c_type = SQL_C_SBIGINT;
+      c.width = sizeof(SQLBIGINT);
+      break;
+    case SQL_REAL:
+    case SQL_FLOAT:
+    case SQL_DOUBLE:
+      c.c_type = SQL_C_DOUBLE;
+      c.width = sizeof(SQLDOUBLE);
+      break;
+    case SQL_BINARY:
+    case SQL_VARBINARY:
+      c.c_type = SQL_C_BINARY;
+      c.width = column_size;
+      break;
+    case SQL_LONGVARBINARY:
+    case SQL_LONGVARCHAR:
+    case SQL_WLONGVARCHAR:
+      c.width = 0;
+      break;
+    default:
+      // characters may take up to four bytes in UTF-8
+      c.c_type = SQL_C_CHAR;
+      c.width = column_size ? 4 * column_size + 1 : 0;
+      break;
+    }
+    c.is_bound = c.width > 0 && c.width <= ODBC_MAX_BOUND_COLUMN_SIZE;
+    if (c.is_bound) {
+      num_bound++;
+    } else if (!has_block_data) {
+      is_bindable = false;
+    }
+  }
+
+  if (!is_bindable || !num_bound) {
+    SQLSetStmtAttr(stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)(SQLULEN)1, 0);
+    return;
+  }
+
+  SQLSetStmtAttr(stmt, SQL_ATTR_ROW_BIND_TYPE, (SQLPOINTER)SQL_BIND_BY_COLUMN, 0);
+  SQLSetStmtAttr(stmt, SQL_ATTR_ROWS_FETCHED_PTR, &rows_fetched, 0);
+  if (!SQL_SUCCEEDED(SQLSetStmtAttr(stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)(SQLULEN)row_array_size, 0))) {
+    SQLSetStmtAttr(stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)(SQLULEN)1, 0);
+    return;
+  }
+  for (unsigned int i = 0; i < num_result_columns; i++) {
+    column_data & c = column_buffers[i];
+    if (!c.is_bound) continue;
+    c.buffer.resize(c.width * row_array_size);
+    c.length.resize(row_array_size);
+    if (!SQL_SUCCEEDED(SQLBindCol(stmt, i + 1, c.c_type, c.buffer.data(), c.width, c.length.data()))) {
+      SQLFreeStmt(stmt, SQL_UNBIND);
+      SQLSetStmtAttr(stmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)(SQLULEN)1, 0);
+      return;
+    }
+  }
+  is_block_cursor = true;
+}
+
+// Sends the values bound with bindStream() for a data-at-execution parameter
+SQLRETURN
+ODBCStatement::sendLongData() {
+  vector<char> buffer(0x10000);
+  SQLPOINTER token = 0;
+  SQLRETURN r;
+  while ((r = SQLParamData(stmt, &token)) == SQL_NEED_DATA) {
+    query_data * d = (query_data *)token;
+    assert(d && d->input);
+    size_t remaining = d->input_len;
+    bool is_sent = false;
+    while (remaining && *d->input) {
+      d->input->read(buffer.data(), remaining < buffer.size() ? remaining : buffer.size());
+      size_t n = (size_t)d->input->gcount();
+      if (!n) break;
+      if (!SQL_SUCCEEDED(SQLPutData(stmt, buffer.data(), (SQLLEN)n))) {
+	throwError(SQLException::EXECUTE_FAILED, SQL_HANDLE_STMT, stmt, getQuery());
+      }
+      remaining -= n;
+      is_sent = true;
+    }
+    if (!is_sent) {
+      SQLPutData(stmt, buffer.data(), 0);
+    }
+    d->input = 0;
+    d->length.assign(1, SQL_NULL_DATA);
+  }
+  return r;
+}
+
+void
+ODBCStatement::addBatch() {
+  for (auto & d : bound_data) {
+    if (d.input) {
+      throw SQLException(SQLException::BIND_FAILED, "Streamed parameters cannot be batched", getQuery());
+    }
+  }
+  batch_rows++;
+  SQLStatement::reset();
+  if (batch_rows >= max_batch_size) {
+    flushBatch();
+  }
+}
+
+unsigned int
+ODBCStatement::executeBatch() {
+  flushBatch();
+  return SQLStatement::executeBatch();
+}
+
+void
+ODBCStatement::flushBatch() {
+  if (!batch_rows) return;
+  size_t num_rows = batch_rows;
+  batch_rows = 0;
+  for (auto & d : bound_data) {
+    if (d.length.size() < num_rows) d.length.resize(num_rows, SQL_NULL_DATA);
+  }
+  try {
+    executeRows(num_rows);
+  } catch (...) {
+    for (auto & d : bound_data) d.length.assign(1, SQL_NULL_DATA);
+    throw;
+  }
+  batch_affected_rows += rows_affected;
+  for (auto & d : bound_data) d.length.assign(1, SQL_NULL_DATA);
+}
+
+void
+ODBCStatement::reset() {
+  SQLStatement::reset();
+
+  if (has_result_set) {
+    SQLFreeStmt(stmt, SQL_CLOSE);
+  }
+  results_available = false;
+  rows_affected = 0;
+  is_query_executed = false;
+  has_result_set = false;
+  data_column = -1;
+
+  for (auto & d : bound_data) {
+    if (d.input) {
+      d.input = 0;
+      d.length.assign(1, SQL_NULL_DATA);
+    }
   }
-  return true;
 }
 
 bool
-ODBC::bind(unsigned int index, const string & str) {
-  return Bind(index, str.c_str());
+ODBCStatement::next() {
+  results_available = false;
+
+  if (!is_query_executed) {
+    execute();
+  }
+
+  if (has_result_set) {
+    data_column = -1;
+    is_positioned = false;
+    for (auto & v : row_cache) v.is_fetched = false;
+    if (is_block_cursor && current_row + 1 < rows_fetched) {
+      current_row++;
+      results_available = true;
+      return true;
+    }
+    SQLRETURN r = SQLFetch(stmt);
+    if (SQL_SUCCEEDED(r)) {
+      current_row = 0;
+      results_available = !is_block_cursor || rows_fetched > 0;
+    } else if (r != SQL_NO_DATA) {
+      throwError(SQLException::EXECUTE_FAILED, SQL_HANDLE_STMT, stmt, getQuery());
+    }
+  }
+
+  return results_available;
+}
+
+// Stores the value into the current row of the parameter's column-wise array
+ODBCStatement &
+ODBCStatement::bindData(SQLSMALLINT c_type, SQLSMALLINT sql_type, const void * ptr, size_t size, bool is_defined) {
+  unsigned int index = getNextBindIndex() - 1;
+  if (index >= bound_data.size()) {
+    throw SQLException(SQLException::BAD_BIND_INDEX, "", getQuery());
+  }
+  query_data & d = bound_data[index];
+  if (d.input) {
+    d.input = 0;
+    d.length.assign(1, SQL_NULL_DATA);
+  }
+  if (d.c_type != c_type && (is_defined || !d.c_type)) {
+    if (batch_rows) {
+      throw SQLException(SQLException::BIND_FAILED, "Parameter type changed within a batch", getQuery());
+    }
+    d.c_type = c_type;
+    d.sql_type = sql_type;
+    d.width = 0;
+    d.buffer.clear();
+  }
+  if (is_defined && (SQLLEN)size > d.width) {
+    SQLLEN width = d.width * 2 > (SQLLEN)size ? d.width * 2 : (SQLLEN)size;
+    vector<char> buffer((batch_rows + 1) * width);
+    for (size_t row = 0; row < batch_rows; row++) {
+      memcpy(&buffer[row * width], &d.buffer[row * d.width], d.width);
+    }
+    d.buffer.swap(buffer);
+    d.width = width;
+  }
+  if (d.width < 1) d.width = 1;
+  if (d.buffer.size() < (batch_rows + 1) * d.width) d.buffer.resize((batch_rows + 1) * d.width);
+  if (d.length.size() < batch_rows + 1) d.length.resize(batch_rows + 1, SQL_NULL_DATA);
+
+  if (is_defined) {
+    if (size) memcpy(&d.buffer[batch_rows * d.width], ptr, size);
+    d.length[batch_rows] = (SQLLEN)size;
+  } else {
+    d.length[batch_rows] = SQL_NULL_DATA;
+  }
+  return *this;
+}
+
+ODBCStatement &
+ODBCStatement::bind(int value, bool is_defined) {
+  SQLINTEGER v = value;
+  return bindData(SQL_C_SLONG, SQL_INTEGER, &v, sizeof(v), is_defined);
+}
+
+ODBCStatement &
+ODBCStatement::bind(long long value, bool is_defined) {
+  SQLBIGINT v = value;
+  return bindData(SQL_C_SBIGINT, SQL_BIGINT, &v, sizeof(v), is_defined);
+}
+
+ODBCStatement &
+ODBCStatement::bind(unsigned int value, bool is_defined) {
+  SQLUINTEGER v = value;
+  return bindData(SQL_C_ULONG, SQL_BIGINT, &v, sizeof(v), is_defined);
+}
+
+ODBCStatement &
+ODBCStatement::bind(double value, bool is_defined) {
+  return bindData(SQL_C_DOUBLE, SQL_DOUBLE, &value, sizeof(value), is_defined);
+}
+
+ODBCStatement &
+ODBCStatement::bind(bool value, bool is_defined) {
+  return bind(value ? 1 : 0, is_defined);
+}
+
+ODBCStatement &
+ODBCStatement::bind(const char * value, bool is_defined) {
+  return bindData(SQL_C_CHAR, SQL_VARCHAR, value, value ? strlen(value) : 0, is_defined && value);
+}
+
+ODBCStatement &
+ODBCStatement::bind(const std::string & value, bool is_defined) {
+  return bindData(SQL_C_CHAR, SQL_VARCHAR, value.data(), value.size(), is_defined);
+}
+
+ODBCStatement &
+ODBCStatement::bind(const ustring & value, bool is_defined) {
+  return bindData(SQL_C_BINARY, SQL_VARBINARY, value.data(), value.size(), is_defined);
+}
+
+ODBCStatement &
+ODBCStatement::bind(const void * data, size_t len, bool is_defined) {
+  return bindData(SQL_C_BINARY, SQL_VARBINARY, data, len, is_defined);
+}
+
+ODBCStatement &
+ODBCStatement::bindStream(std::istream & input, size_t len, bool is_defined) {
+  if (!is_defined) {
+    return bindData(SQL_C_BINARY, SQL_LONGVARBINARY, 0, 0, false);
+  }
+  if (batch_rows) {
+    throw SQLException(SQLException::BIND_FAILED, "Streamed parameters cannot be batched", getQuery());
+  }
+  unsigned int index = getNextBindIndex() - 1;
+  if (index >= bound_data.size()) {
+    throw SQLException(SQLException::BAD_BIND_INDEX, "", getQuery());
+  }
+  query_data & d = bound_data[index];
+  d.c_type = SQL_C_BINARY;
+  d.sql_type = SQL_LONGVARBINARY;
+  d.input = &input;
+  d.input_len = len;
+  d.length.assign(1, SQL_LEN_DATA_AT_EXEC((SQLLEN)len));
+  return *this;
+}
+
+// Returns the value of the current row, or null for SQL NULL
+const char *
+ODBCStatement::getBoundData(int column_index, SQLSMALLINT & c_type, SQLLEN & len) {
+  if (column_index < 0 || column_index >= (int)num_result_columns) throw SQLException(SQLException::BAD_COLUMN_INDEX, "", getQuery());
+
+  if (!results_available) {
+    return 0;
+  }
+  auto get_cached = [&]() -> const char * {
+    const cached_value_s & v = getCachedValue(column_index);
+    if (v.is_null) return 0;
+    c_type = v.c_type;
+    len = (SQLLEN)v.data.size();
+    return v.data.data();
+  };
+  const column_data & c = column_buffers[column_index];
+  if (!is_block_cursor || !c.is_bound) {
+    positionCursor();
+    return get_cached();
+  }
+  len = c.length[current_row];
+  if (len == SQL_NULL_DATA) {
+    return 0;
+  }
+  SQLLEN max_len = c.c_type == SQL_C_CHAR ? c.width - 1 : c.width;
+  if (len != SQL_NO_TOTAL && len <= max_len) {
+    c_type = c.c_type;
+    return &c.buffer[current_row * c.width];
+  }
+  // the value did not fit in the bound buffer and is read again in full
+  if ((getdata_extensions & (SQL_GD_BLOCK | SQL_GD_BOUND)) != (SQL_GD_BLOCK | SQL_GD_BOUND)) {
+    throw SQLException(SQLException::GET_FAILED, "Column value truncated", getQuery());
+  }
+  positionCursor();
+  return get_cached();
+}
+
+// SQLGetData reads the row of the block that the cursor is positioned on
+void
+ODBCStatement::positionCursor() {
+  if (!is_block_cursor || is_positioned) return;
+  if (!SQL_SUCCEEDED(SQLSetPos(stmt, current_row + 1, SQL_POSITION, SQL_LOCK_NO_CHANGE))) {
+    throwError(SQLException::GET_FAILED, SQL_HANDLE_STMT, stmt, getQuery());
+  }
+  is_positioned = true;
+}
+
+// Columns that are not in the bound buffers are read once per row with
+// SQLGetData in the C type a bound column would have. Drivers need not support reading
+// a column again, or in another C type, so all getters use the cached value.
+const ODBCStatement::cached_value_s &
+ODBCStatement::getCachedValue(int column_index) {
+  if (row_cache.size() < num_result_columns) row_cache.resize(num_result_columns);
+  cached_value_s & v = row_cache[column_index];
+  if (v.is_fetched) return v;
+  v.is_fetched = true;
+  v.data.clear();
+
+  // a column that readBlob() has started is not null
+  bool is_streamed = data_column == column_index;
+  SQLSMALLINT sql_type = column_index < (int)column_buffers.size() ? column_buffers[column_index].sql_type : 0;
+  SQLLEN ind = 0;
+  switch (sql_type) {
+  case SQL_BIT:
+  case SQL_TINYINT:
+  case SQL_SMALLINT:
+  case SQL_INTEGER:
+  case SQL_BIGINT:
+    {
+      SQLBIGINT a = 0;
+      v.c_type = SQL_C_SBIGINT;
+      v.is_null = !getData(column_index, v.c_type, &a, sizeof(a), &ind);
+      if (!v.is_null) v.data.assign((const char *)&a, sizeof(a));
+    }
+    break;
+  case SQL_REAL:
+  case SQL_FLOAT:
+  case SQL_DOUBLE:
+    {
+      SQLDOUBLE a = 0;
+      v.c_type = SQL_C_DOUBLE;
+      v.is_null = !getData(column_index, v.c_type, &a, sizeof(a), &ind);
+      if (!v.is_null) v.data.assign((const char *)&a, sizeof(a));
+    }
+    break;
+  default:
+    {
+      bool is_binary = sql_type == SQL_BINARY || sql_type == SQL_VARBINARY || sql_type == SQL_LONGVARBINARY;
+      v.c_type = is_binary ? SQL_C_BINARY : SQL_C_CHAR;
+      // character data is null-terminated in each part
+      char buffer[4096];
+      size_t part_size = is_binary ? sizeof(buffer) : sizeof(buffer) - 1;
+      v.is_null = true;
+      while (getData(column_index, v.c_type, buffer, sizeof(buffer), &ind)) {
+	v.is_null = false;
+	bool is_truncated = ind == SQL_NO_TOTAL || ind > (SQLLEN)part_size;
+	if (v.data.empty() && ind != SQL_NO_TOTAL && ind > (SQLLEN)part_size) v.data.reserve(ind);
+	v.data.append(buffer, is_truncated ? part_size : (size_t)ind);
+	if (!is_truncated) break;
+      }
+    }
+    break;
+  }
+  if (is_streamed) v.is_null = false;
+  return v;
 }
 
 bool
-ODBC::bind(unsigned int index, const char * str) {
-  if (!stmt) return false;
-  query_data & qd = BindData(str, strlen(str));
-  if (!SQL_SUCCEEDED(SQLBindParameter(stmt, index, SQL_PARAM_INPUT, SQL_C_CHAR,
-				      SQL_CHAR, 0, 0, qd.ptr, qd.size, &qd.size))) {
-    fprintf(stderr, "ODBC failed to bind\n");
+ODBCStatement::getData(int column_index, SQLSMALLINT c_type, void * buffer, SQLLEN len, SQLLEN * indicator) {
+  if (column_index < 0 || column_index >= (int)num_result_columns) throw SQLException(SQLException::BAD_COLUMN_INDEX, "", getQuery());
+
+  data_column = -1;
+  if (!results_available) {
     return false;
   }
-  return true;
+  SQLRETURN r = SQLGetData(stmt, column_index + 1, c_type, buffer, len, indicator);
+  if (r == SQL_NO_DATA) {
+    return false;
+  } else if (!SQL_SUCCEEDED(r)) {
+    throwError(SQLException::GET_FAILED, SQL_HANDLE_STMT, stmt, getQuery());
+  }
+  return *indicator != SQL_NULL_DATA;
 }
 
 bool
-ODBC::execute() {
-  if (!stmt) return false;
-  long rv = SQLExecute(stmt);
-  ClearBoundData();
-  if (SQL_SUCCEEDED(rv) || rv == SQL_NO_DATA) {
-    return true;
-  } else {
-    error_string = createErrorString(SQL_HANDLE_STMT, stmt);
-    fprintf(stderr, "ODBC execute failed(%d): %s\n", rv, error_string.c_str());
-    return false;
+ODBCStatement::isNull(int column_index) {
+  SQLSMALLINT c_type;
+  SQLLEN len;
+  return getBoundData(column_index, c_type, len) == 0;
+}
+
+int
+ODBCStatement::getInt(int column_index) {
+  return (int)getLongLong(column_index);
+}
+
+unsigned int
+ODBCStatement::getUInt(int column_index) {
+  return (unsigned int)getLongLong(column_index);
+}
+
+double
+ODBCStatement::getDouble(int column_index) {
+  SQLSMALLINT c_type;
+  SQLLEN len;
+  const char * ptr = getBoundData(column_index, c_type, len);
+  if (!ptr) return 0;
+  switch (c_type) {
+  case SQL_C_DOUBLE: return *(const SQLDOUBLE *)ptr;
+  case SQL_C_SBIGINT: return (double)*(const SQLBIGINT *)ptr;
+  case SQL_C_CHAR: return strtod(string(ptr, len).c_str(), 0);
   }
+  return 0;
 }
 
-void
-ODBC::Commit() {
-  if (!env) return;
-  SQLEndTran(SQL_HANDLE_ENV, env, SQL_COMMIT);
+long long
+ODBCStatement::getLongLong(int column_index) {
+  SQLSMALLINT c_type;
+  SQLLEN len;
+  const char * ptr = getBoundData(column_index, c_type, len);
+  if (!ptr) return 0;
+  switch (c_type) {
+  case SQL_C_SBIGINT: return *(const SQLBIGINT *)ptr;
+  case SQL_C_DOUBLE: return (long long)*(const SQLDOUBLE *)ptr;
+  case SQL_C_CHAR: return strtoll(string(ptr, len).c_str(), 0, 10);
+  }
+  return 0;
 }
 
-void
-ODBC::Rollback() {
-  if (!env) return;
-  SQLEndTran(SQL_HANDLE_ENV, env, SQL_ROLLBACK);
+bool
+ODBCStatement::getBool(int column_index) {
+  return getInt(column_index) ? true : false;
 }
 
 string
-ODBC::createErrorString(SQLSMALLINT handle_type, SQLHANDLE handle) {
-  if (!handle) return "Invalid handle";
+ODBCStatement::getText(int column_index) {
+  SQLSMALLINT c_type;
+  SQLLEN len;
+  const char * ptr = getBoundData(column_index, c_type, len);
+  if (!ptr) return string();
+  char tmp[32];
+  switch (c_type) {
+  case SQL_C_SBIGINT:
+    snprintf(tmp, sizeof(tmp), "%lld", (long long)*(const SQLBIGINT *)ptr);
+    return tmp;
+  case SQL_C_DOUBLE:
+    snprintf(tmp, sizeof(tmp), "%.17g", *(const SQLDOUBLE *)ptr);
+    return tmp;
+  }
+  return string(ptr, len);
+}
 
-  SQLSMALLINT errRecNo = 1;
-  SQLCHAR errSQLStateBuf[256];
-  SQLINTEGER errCode = 0;
-  SQLCHAR errMsgBuf[256]; 
-  SQLSMALLINT errMsgBufLen = 256;
-  SQLSMALLINT errInfoSize;
-  
-  memset (errSQLStateBuf, 0x00, sizeof (errSQLStateBuf));
-  memset (errMsgBuf, 0x00, sizeof (errMsgBuf));
-
-  long retcode = SQLGetDiagRec (handle_type, handle, errRecNo,
-               errSQLStateBuf, &errCode, errMsgBuf, errMsgBufLen,
-               &errInfoSize);
-
-  if (retcode != SQL_NO_DATA_FOUND) {
-    fprintf(stderr, "ODBC error: %s\n", (char*)errMsgBuf);
-    errRecNo++;
-    return (char*)errMsgBuf;
-  } else {
-    fprintf(stderr, "ODBC error: not found\n");
-    return "";
+ustring
+ODBCStatement::getBlob(int column_index) {
+  SQLSMALLINT c_type;
+  SQLLEN len;
+  const char * ptr = getBoundData(column_index, c_type, len);
+  if (!ptr) return ustring();
+  if (c_type == SQL_C_SBIGINT || c_type == SQL_C_DOUBLE) {
+    string s = getText(column_index);
+    return ustring((const unsigned char *)s.data(), s.size());
+  }
+  return ustring((const unsigned char *)ptr, len);
+}
+
+size_t
+ODBCStatement::getBlobSize(int column_index) {
+  SQLSMALLINT c_type;
+  SQLLEN len;
+  const char * ptr = getBoundData(column_index, c_type, len);
+  if (!ptr) return 0;
+  if (c_type == SQL_C_SBIGINT || c_type == SQL_C_DOUBLE) return getText(column_index).size();
+  return (size_t)len;
+}
+
+// SQLGetData returns long values in consecutive parts, so a column that is
+// not bound and has not been read by another getter is streamed and can only
+// be read forward
+size_t
+ODBCStatement::readBlob(int column_index, size_t offset, void * buffer, size_t len) {
+  bool is_cached = column_index >= 0 && column_index < (int)row_cache.size() && row_cache[column_index].is_fetched;
+  bool is_bound = is_block_cursor && column_index >= 0 && column_index < (int)column_buffers.size() && column_buffers[column_index].is_bound;
+  if (is_bound || is_cached) {
+    SQLSMALLINT c_type;
+    SQLLEN size;
+    const char * ptr = getBoundData(column_index, c_type, size);
+    string tmp;
+    if (ptr && (c_type == SQL_C_SBIGINT || c_type == SQL_C_DOUBLE)) {
+      tmp = getText(column_index);
+      ptr = tmp.data();
+      size = (SQLLEN)tmp.size();
+    }
+    if (!ptr || offset >= (size_t)size) return 0;
+    if (len > (size_t)size - offset) len = (size_t)size - offset;
+    memcpy(buffer, ptr + offset, len);
+    return len;
+  }
+  size_t position = data_column == column_index ? data_offset : 0;
+  if (offset < position) {
+    throw SQLException(SQLException::GET_FAILED, "Column data can only be read forward", getQuery());
+  }
+  positionCursor();
+
+  auto read_part = [&](void * ptr, size_t n) -> size_t {
+    SQLLEN ind = 0;
+    if (!n || !getData(column_index, SQL_C_BINARY, ptr, (SQLLEN)n, &ind)) return 0;
+    return ind == SQL_NO_TOTAL || ind > (SQLLEN)n ? n : (size_t)ind;
+  };
+
+  char skip[4096];
+  while (position < offset) {
+    size_t n = read_part(skip, offset - position < sizeof(skip) ? offset - position : sizeof(skip));
+    if (!n) return 0;
+    position += n;
   }
+  size_t n = read_part(buffer, len);
+  data_column = column_index;
+  data_offset = position + n;
+  return n;
 }
@@ -0,0 +1,192 @@
+#include "PrefetchingStatement.h"
+
+#include <cstring>
+
+using namespace std;
+using namespace sqldb;
+
+PrefetchingStatement::PrefetchingStatement(std::shared_ptr<SQLStatement> _stmt, const PrefetchOptions & _options)
+  : SQLStatement(_stmt->getQuery()),
+    stmt(_stmt),
+    options(_options)
+{
+  if (!options.batch_size) options.batch_size = 1;
+  if (!options.depth) options.depth = 1;
+  ring.resize(options.depth);
+
+  vector<string> parameter_names;
+  rewriteNamedParameters(getQuery(), parameter_names);
+  for (unsigned int i = 0; i < parameter_names.size(); i++) {
+    addNamedParameter(parameter_names[i], i + 1);
+  }
+
+  // metadata is copied since the wrapped statement belongs to the reader thread
+  unsigned int num_fields = stmt->getNumFields();
+  columns.resize(num_fields);
+  for (unsigned int i = 0; i < num_fields; i++) {
+    columns[i].name = stmt->getColumnName(i);
+    columns[i].type = stmt->getColumnType(i);
+    columns[i].size = stmt->getColumnSize(i);
+  }
+}
+
+PrefetchingStatement::~PrefetchingStatement() {
+  stop();
+}
+
+unsigned int
+PrefetchingStatement::execute() {
+  stop();
+  return stmt->execute();
+}
+
+bool
+PrefetchingStatement::next() {
+  if (!is_started) {
+    is_started = true;
+    is_finished = is_stopping = false;
+    error = nullptr;
+    thread = std::thread([this] { run(); });
+  }
+
+  if (current && ++row < current->size()) {
+    results_available = true;
+    return true;
+  }
+
+  current.reset();
+  results_available = false;
+  waitFor([this] { return head.load() != tail.load() || is_finished.load(); });
+
+  size_t h = head.load();
+  if (h == tail.load()) {
+    // the ring is only empty after the last batch has been read
+    if (error) rethrow_exception(error);
+    return false;
+  }
+  current = std::move(ring[h % ring.size()]);
+  head.store(h + 1);
+  wake();
+
+  row = 0;
+  results_available = true;
+  return true;
+}
+
+void
+PrefetchingStatement::reset() {
+  stop();
+  SQLStatement::reset();
+  stmt->reset();
+}
+
+PrefetchingStatement &
+PrefetchingStatement::bind(const void * data, size_t len, bool is_defined) {
+  stop();
+  stmt->setBindIndex(getNextBindIndex());
+  stmt->bind(data, len, is_defined);
+  return *this;
+}
+
+PrefetchingStatement &
+PrefetchingStatement::bindStream(std::istream & input, size_t len, bool is_defined) {
+  stop();
+  stmt->setBindIndex(getNextBindIndex());
+  stmt->bindStream(input, len, is_defined);
+  return *this;
+}
+
+void
+PrefetchingStatement::run() {
+  try {
+    while (!is_stopping) {
+      auto batch = stmt->fetchAll(options.batch_size);
+      // a short batch is the last one and next() must not be called again
+      // since some backends would restart the query
+      bool is_last = batch->size() < options.batch_size;
+      if (!batch->empty()) {
+	waitFor([this] { return tail.load() - head.load() < ring.size() || is_stopping.load(); });
+	if (is_stopping) break;
+	size_t t = tail.load();
+	ring[t % ring.size()] = std::move(batch);
+	tail.store(t + 1);
+	wake();
+      }
+      if (is_last) break;
+    }
+  } catch (...) {
+    error = current_exception();
+  }
+  is_finished = true;
+  wake();
+}
+
+void
+PrefetchingStatement::stop() {
+  if (thread.joinable()) {
+    is_stopping = true;
+    wake();
+    thread.join();
+  }
+  for (auto & batch : ring) batch.reset();
+  head = tail = 0;
+  is_started = false;
+  current.reset();
+  row = 0;
+  results_available = false;
+}
+
+// A waiter registers itself before checking the condition under the mutex,
+// and wake() checks for waiters after publishing, so a wakeup cannot be lost
+template <class F>
+void
+PrefetchingStatement::waitFor(F is_ready) {
+  for (int i = 0; i < 64; i++) {
+    if (is_ready()) return;
+    std::this_thread::yield();
+  }
+  unique_lock<std::mutex> lock(wait_mutex);
+  num_waiting++;
+  wait_cond.wait(lock, is_ready);
+  num_waiting--;
+}
+
+void
+PrefetchingStatement::wake() {
+  if (num_waiting.load()) {
+    { lock_guard<std::mutex> guard(wait_mutex); }
+    wait_cond.notify_all();
+  }
+}
+
+const ResultSet &
+PrefetchingStatement::getResult() const {
+  if (!results_available) {
+    throw SQLException(SQLException::GET_FAILED, "No row", getQuery());
+  }
+  return *current;
+}
+
+size_t
+PrefetchingStatement::getBlobSize(int column_index) {
+  const ResultSet & rs = getResult();
+  if (rs.isNull(row, column_index)) return 0;
+  auto v = rs.getTextView(row, column_index);
+  return v.data() ? v.size() : rs.getText(row, column_index).size();
+}
+
+size_t
+PrefetchingStatement::readBlob(int column_index, size_t offset, void * buffer, size_t len) {
+  const ResultSet & rs = getResult();
+  if (rs.isNull(row, column_index)) return 0;
+  string tmp;
+  auto v = rs.getTextView(row, column_index);
+  if (!v.data()) {
+    tmp = rs.getText(row, column_index);
+    v = tmp;
+  }
+  if (offset >= v.size()) return 0;
+  size_t n = min(len, v.size() - offset);
+  memcpy(buffer, v.data() + offset, n);
+  return n;
+}
@@ -0,0 +1,320 @@
+#include "Recording.h"
+
+using namespace std;
+using namespace sqldb;
+
+RecordingConnection::RecordingConnection(std::shared_ptr<Connection> _conn, std::shared_ptr<WorkloadLog> _log)
+  : conn(_conn), log(_log)
+{
+  session = log->createSession();
+}
+
+void
+RecordingConnection::record(WorkloadRecord::Type type, unsigned long long started, const char * query) {
+  WorkloadRecord r;
+  r.type = type;
+  r.session = session;
+  r.timestamp_ns = started;
+  r.statement_id = 0;
+  r.duration_ns = log->getTimestamp() - started;
+  r.rows = 0;
+  if (query) r.query = query;
+  log->append(r);
+}
+
+std::shared_ptr<SQLStatement>
+RecordingConnection::prepare(const string & query) {
+  unsigned long long started = log->getTimestamp();
+  auto stmt = conn->prepare(query);
+  unsigned long long statement_id = log->createStatementId();
+
+  WorkloadRecord r;
+  r.type = WorkloadRecord::PREPARE;
+  r.session = session;
+  r.timestamp_ns = started;
+  r.statement_id = statement_id;
+  r.duration_ns = log->getTimestamp() - started;
+  r.rows = 0;
+  r.query = query;
+  log->append(r);
+
+  return std::make_shared<RecordingStatement>(stmt, log, session, statement_id);
+}
+
+void
+RecordingConnection::begin() {
+  unsigned long long started = log->getTimestamp();
+  conn->begin();
+  record(WorkloadRecord::BEGIN, started);
+}
+
+void
+RecordingConnection::commit() {
+  unsigned long long started = log->getTimestamp();
+  conn->commit();
+  record(WorkloadRecord::COMMIT, started);
+}
+
+void
+RecordingConnection::rollback() {
+  unsigned long long started = log->getTimestamp();
+  conn->rollback();
+  record(WorkloadRecord::ROLLBACK, started);
+}
+
+unsigned int
+RecordingConnection::execute(const char * query) {
+  unsigned long long started = log->getTimestamp();
+  unsigned int r = conn->execute(query);
+  record(WorkloadRecord::QUERY, started, query);
+  return r;
+}
+
+// Named parameters are resolved here since the bind index is tracked by
+// this statement and passed to the wrapped one on every bind
+RecordingStatement::RecordingStatement(std::shared_ptr<SQLStatement> _stmt, std::shared_ptr<WorkloadLog> _log, unsigned int _session, unsigned long long _statement_id)
+  : SQLStatement(_stmt->getQuery()),
+    stmt(_stmt),
+    log(_log),
+    session(_session),
+    statement_id(_statement_id)
+{
+  vector<string> parameter_names;
+  rewriteNamedParameters(getQuery(), parameter_names);
+  for (unsigned int i = 0; i < parameter_names.size(); i++) {
+    addNamedParameter(parameter_names[i], i + 1);
+  }
+
+  unsigned int num_fields = stmt->getNumFields();
+  columns.resize(num_fields);
+  for (unsigned int i = 0; i < num_fields; i++) {
+    columns[i].name = stmt->getColumnName(i);
+    columns[i].type = stmt->getColumnType(i);
+    columns[i].size = stmt->getColumnSize(i);
+  }
+}
+
+RecordingStatement::~RecordingStatement() {
+  recordRows();
+}
+
+void
+RecordingStatement::record(WorkloadRecord::Type type, unsigned long long started, unsigned long long rows, bool with_parameters) {
+  WorkloadRecord r;
+  r.type = type;
+  r.session = session;
+  r.timestamp_ns = started;
+  r.statement_id = statement_id;
+  r.duration_ns = log->getTimestamp() - started;
+  r.rows = rows;
+  if (with_parameters) r.parameters = parameters;
+  log->append(r);
+}
+
+// Row counts are recorded when the result has been read or abandoned
+void
+RecordingStatement::recordRows() {
+  if (is_query_executed && num_rows) {
+    record(WorkloadRecord::ROWS, fetch_started, num_rows);
+  }
+  num_rows = 0;
+}
+
+unsigned int
+RecordingStatement::execute() {
+  recordRows();
+  unsigned long long started = log->getTimestamp();
+  unsigned int r = stmt->execute();
+  is_query_executed = true;
+  fetch_started = log->getTimestamp();
+  record(WorkloadRecord::EXECUTE, started, r, true);
+  return r;
+}
+
+SQLStatus<unsigned int>
+RecordingStatement::tryExecute() {
+  recordRows();
+  unsigned long long started = log->getTimestamp();
+  SQLStatus<unsigned int> r = stmt->tryExecute();
+  is_query_executed = true;
+  fetch_started = log->getTimestamp();
+  record(WorkloadRecord::EXECUTE, started, r.ok() ? r.getValue() : 0, true);
+  return r;
+}
+
+bool
+RecordingStatement::next() {
+  unsigned long long started = log->getTimestamp();
+  bool r = stmt->next();
+  if (!is_query_executed) {
+    // the first next() executes the query implicitly
+    is_query_executed = true;
+    fetch_started = started;
+    record(WorkloadRecord::EXECUTE, started, 0, true);
+  }
+  if (r) num_rows++;
+  else recordRows();
+  results_available = r;
+  return r;
+}
+
+SQLStatus<bool>
+RecordingStatement::tryNext() {
+  unsigned long long started = log->getTimestamp();
+  SQLStatus<bool> r = stmt->tryNext();
+  if (!is_query_executed) {
+    is_query_executed = true;
+    fetch_started = started;
+    record(WorkloadRecord::EXECUTE, started, 0, true);
+  }
+  if (r.ok() && r.getValue()) num_rows++;
+  else recordRows();
+  results_available = r.ok() && r.getValue();
+  return r;
+}
+
+void
+RecordingStatement::reset() {
+  recordRows();
+  SQLStatement::reset();
+  stmt->reset();
+  parameters.clear();
+  is_query_executed = false;
+  results_available = false;
+}
+
+void
+RecordingStatement::addBatch() {
+  unsigned long long started = log->getTimestamp();
+  stmt->addBatch();
+  record(WorkloadRecord::BATCH_ADD, started, 0, true);
+  SQLStatement::reset();
+  parameters.clear();
+}
+
+unsigned int
+RecordingStatement::executeBatch() {
+  unsigned long long started = log->getTimestamp();
+  unsigned int r = stmt->executeBatch();
+  record(WorkloadRecord::BATCH_EXECUTE, started, r);
+  return r;
+}
+
+// Returns the recorded value for the next bind index and moves the wrapped
+// statement to the same index
+WorkloadParameter &
+RecordingStatement::getParameter() {
+  unsigned int index = getNextBindIndex();
+  stmt->setBindIndex(index);
+  if (parameters.size() < index) parameters.resize(index);
+  WorkloadParameter & p = parameters[index - 1];
+  p = WorkloadParameter();
+  return p;
+}
+
+RecordingStatement &
+RecordingStatement::bind(bool value, bool is_defined) {
+  WorkloadParameter & p = getParameter();
+  stmt->bind(value, is_defined);
+  if (is_defined) {
+    p.type = WorkloadParameter::INT;
+    p.int_value = value ? 1 : 0;
+  }
+  return *this;
+}
+
+RecordingStatement &
+RecordingStatement::bind(int value, bool is_defined) {
+  WorkloadParameter & p = getParameter();
+  stmt->bind(value, is_defined);
+  if (is_defined) {
+    p.type = WorkloadParameter::INT;
+    p.int_value = value;
+  }
+  return *this;
+}
+
+RecordingStatement &
+RecordingStatement::bind(unsigned int value, bool is_defined) {
+  WorkloadParameter & p = getParameter();
+  stmt->bind(value, is_defined);
+  if (is_defined) {
+    p.type = WorkloadParameter::INT;
+    p.int_value = value;
+  }
+  return *this;
+}
+
+RecordingStatement &
+RecordingStatement::bind(long long value, bool is_defined) {
+  WorkloadParameter & p = getParameter();
+  stmt->bind(value, is_defined);
+  if (is_defined) {
+    p.type = WorkloadParameter::INT;
+    p.int_value = value;
+  }
+  return *this;
+}
+
+RecordingStatement &
+RecordingStatement::bind(double value, bool is_defined) {
+  WorkloadParameter & p = getParameter();
+  stmt->bind(value, is_defined);
+  if (is_defined) {
+    p.type = WorkloadParameter::DOUBLE;
+    p.double_value = value;
+  }
+  return *this;
+}
+
+RecordingStatement &
+RecordingStatement::bind(const char * value, bool is_defined) {
+  WorkloadParameter & p = getParameter();
+  stmt->bind(value, is_defined);
+  if (is_defined) {
+    p.type = WorkloadParameter::TEXT;
+    p.data = value;
+  }
+  return *this;
+}
+
+RecordingStatement &
+RecordingStatement::bind(const std::string & value, bool is_defined) {
+  WorkloadParameter & p = getParameter();
+  stmt->bind(value, is_defined);
+  if (is_defined) {
+    p.type = WorkloadParameter::TEXT;
+    p.data = value;
+  }
+  return *this;
+}
+
+RecordingStatement &
+RecordingStatement::bind(const ustring & value, bool is_defined) {
+  WorkloadParameter & p = getParameter();
+  stmt->bind(value, is_defined);
+  if (is_defined) {
+    p.type = WorkloadParameter::BLOB;
+    p.data.assign((const char *)value.data(), value.size());
+  }
+  return *this;
+}
+
+RecordingStatement &
+RecordingStatement::bind(const void * data, size_t len, bool is_defined) {
+  WorkloadParameter & p = getParameter();
+  stmt->bind(data, len, is_defined);
+  if (is_defined) {
+    p.type = WorkloadParameter::BLOB;
+    p.data.assign((const char *)data, len);
+  }
+  return *this;
+}
+
+// Streamed values are not read twice, so they are recorded as NULL
+RecordingStatement &
+RecordingStatement::bindStream(std::istream & input, size_t len, bool is_defined) {
+  getParameter();
+  stmt->bindStream(input, len, is_defined);
+  return *this;
+}
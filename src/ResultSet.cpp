@@ -0,0 +1,175 @@
+#include "ResultSet.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+using namespace sqldb;
+
+ResultSet::ResultSet(SQLStatement & stmt, size_t max_rows, std::pmr::memory_resource * resource)
+  : cells(resource ? resource : std::pmr::get_default_resource()),
+    data(resource ? resource : std::pmr::get_default_resource())
+{
+  while ((!max_rows || num_rows < max_rows) && stmt.next()) {
+    if (!num_rows) {
+      readColumns(stmt);
+    }
+
+    for (unsigned int i = 0; i < num_columns; i++) {
+      cell_s cell;
+      memset(&cell, 0, sizeof(cell));
+      if (stmt.isNull(i)) {
+	cell.type = CELL_NULL;
+      } else {
+	switch (stmt.getColumnType(i)) {
+	case SQLStatement::INT:
+	case SQLStatement::INT64:
+	  cell.type = CELL_INT;
+	  cell.int_value = stmt.getLongLong(i);
+	  break;
+	case SQLStatement::DOUBLE:
+	  cell.type = CELL_DOUBLE;
+	  cell.double_value = stmt.getDouble(i);
+	  break;
+	default:
+	  {
+	    // variable length data is read straight into the data block
+	    size_t len = stmt.getBlobSize(i);
+	    if (len > 0xffffffff) {
+	      throw SQLException(SQLException::GET_FAILED, "Value too large", stmt.getQuery());
+	    }
+	    cell.type = stmt.getColumnType(i) == SQLStatement::BLOB ? CELL_BLOB : CELL_TEXT;
+	    cell.offset = data.size();
+	    data.resize(data.size() + len);
+	    cell.len = (uint32_t)stmt.readBlob(i, 0, data.data() + cell.offset, len);
+	    data.resize(cell.offset + cell.len);
+	  }
+	  break;
+	}
+      }
+      cells.push_back(cell);
+    }
+    num_rows++;
+  }
+
+  if (!num_rows) {
+    readColumns(stmt);
+  }
+
+  cells.shrink_to_fit();
+  data.shrink_to_fit();
+}
+
+void
+ResultSet::readColumns(SQLStatement & stmt) {
+  num_columns = stmt.getNumFields();
+  for (unsigned int i = 0; i < num_columns; i++) {
+    column_names.push_back(stmt.getColumnName(i));
+    column_types.push_back(stmt.getColumnType(i));
+  }
+}
+
+const std::string &
+ResultSet::getColumnName(int column_index) const {
+  if (column_index < 0 || column_index >= (int)num_columns) {
+    throw SQLException(SQLException::BAD_COLUMN_INDEX);
+  }
+  return column_names[column_index];
+}
+
+SQLStatement::ColumnType
+ResultSet::getColumnType(int column_index) const {
+  if (column_index < 0 || column_index >= (int)num_columns) {
+    throw SQLException(SQLException::BAD_COLUMN_INDEX);
+  }
+  return column_types[column_index];
+}
+
+long long
+ResultSet::getLongLong(size_t row, int column_index) const {
+  const cell_s & cell = getCell(row, column_index);
+  switch (cell.type) {
+  case CELL_INT: return cell.int_value;
+  case CELL_DOUBLE: return (long long)cell.double_value;
+  case CELL_TEXT: return strtoll(string(data.data() + cell.offset, cell.len).c_str(), 0, 10);
+  }
+  return 0;
+}
+
+double
+ResultSet::getDouble(size_t row, int column_index) const {
+  const cell_s & cell = getCell(row, column_index);
+  switch (cell.type) {
+  case CELL_INT: return (double)cell.int_value;
+  case CELL_DOUBLE: return cell.double_value;
+  case CELL_TEXT: return strtod(string(data.data() + cell.offset, cell.len).c_str(), 0);
+  }
+  return 0;
+}
+
+std::string_view
+ResultSet::getTextView(size_t row, int column_index) const {
+  const cell_s & cell = getCell(row, column_index);
+  if (cell.type == CELL_TEXT || cell.type == CELL_BLOB) {
+    return std::string_view(data.data() + cell.offset, cell.len);
+  }
+  return std::string_view();
+}
+
+std::string
+ResultSet::getText(size_t row, int column_index) const {
+  const cell_s & cell = getCell(row, column_index);
+  char tmp[32];
+  switch (cell.type) {
+  case CELL_INT:
+    snprintf(tmp, sizeof(tmp), "%lld", cell.int_value);
+    return tmp;
+  case CELL_DOUBLE:
+    snprintf(tmp, sizeof(tmp), "%.17g", cell.double_value);
+    return tmp;
+  case CELL_TEXT:
+  case CELL_BLOB:
+    return string(data.data() + cell.offset, cell.len);
+  }
+  return string();
+}
+
+ustring
+ResultSet::getBlob(size_t row, int column_index) const {
+  const cell_s & cell = getCell(row, column_index);
+  if (cell.type == CELL_TEXT || cell.type == CELL_BLOB) {
+    return ustring((const unsigned char *)data.data() + cell.offset, cell.len);
+  }
+  string s = getText(row, column_index);
+  return ustring((const unsigned char *)s.data(), s.size());
+}
+
+int
+ResultSet::compare(size_t row, int column_index, const ResultSet & other, size_t other_row, int other_column_index) const {
+  const cell_s & a = getCell(row, column_index);
+  const cell_s & b = other.getCell(other_row, other_column_index);
+  // ints and doubles belong to the same class
+  int class_a = a.type == CELL_DOUBLE ? (int)CELL_INT : (int)a.type;
+  int class_b = b.type == CELL_DOUBLE ? (int)CELL_INT : (int)b.type;
+  if (class_a != class_b) {
+    return class_a < class_b ? -1 : 1;
+  }
+  switch (a.type) {
+  case CELL_NULL:
+    return 0;
+  case CELL_INT:
+  case CELL_DOUBLE:
+    if (a.type == CELL_INT && b.type == CELL_INT) {
+      return a.int_value < b.int_value ? -1 : (a.int_value > b.int_value ? 1 : 0);
+    } else {
+      double va = a.type == CELL_INT ? (double)a.int_value : a.double_value;
+      double vb = b.type == CELL_INT ? (double)b.int_value : b.double_value;
+      return va < vb ? -1 : (va > vb ? 1 : 0);
+    }
+  }
+  std::string_view va(data.data() + a.offset, a.len);
+  std::string_view vb(other.data.data() + b.offset, b.len);
+  int r = va.compare(vb);
+  return r < 0 ? -1 : (r > 0 ? 1 : 0);
+}
@@ -0,0 +1,254 @@
+#include "SQLStatement.h"
+
+#include "ResultSet.h"
+
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+using namespace sqldb;
+
+// Backends without a native non-throwing path fall back to catching
+SQLStatus<unsigned int>
+SQLStatement::tryExecute() {
+  try {
+    return execute();
+  } catch (SQLException & e) {
+    return e.getType();
+  }
+}
+
+SQLStatus<bool>
+SQLStatement::tryNext() {
+  try {
+    return next();
+  } catch (SQLException & e) {
+    return e.getType();
+  }
+}
+
+std::shared_ptr<const ResultSet>
+SQLStatement::fetchAll(size_t max_rows, std::pmr::memory_resource * resource) {
+  if (!resource && memory_tracker) {
+    // the result keeps the tracker since it can outlive the statement
+    return std::make_shared<const ResultSet>(*this, max_rows, std::shared_ptr<std::pmr::memory_resource>(memory_tracker));
+  }
+  return std::make_shared<const ResultSet>(*this, max_rows, resource ? resource : getMemoryResource());
+}
+
+std::pmr::string
+SQLStatement::getText(int column_index, std::pmr::memory_resource * resource) {
+  if (!resource) resource = getMemoryResource();
+  ColumnType type = getColumnType(column_index);
+  if (type == INT || type == INT64 || type == DOUBLE) {
+    // numbers are short enough for the small string buffer
+    std::string s = getText(column_index);
+    return std::pmr::string(s.data(), s.size(), resource);
+  }
+  std::pmr::string s(resource);
+  readValue(column_index, s);
+  return s;
+}
+
+pmr_ustring
+SQLStatement::getBlob(int column_index, std::pmr::memory_resource * resource) {
+  if (!resource) resource = getMemoryResource();
+  ColumnType type = getColumnType(column_index);
+  if (type == INT || type == INT64 || type == DOUBLE) {
+    std::string s = getText(column_index);
+    return pmr_ustring((const unsigned char *)s.data(), s.size(), resource);
+  }
+  pmr_ustring s(resource);
+  readValue(column_index, s);
+  return s;
+}
+
+// Reads a whole value with readBlob(). The size is only a hint since some
+// backends cannot tell it in advance.
+template <class T>
+void
+SQLStatement::readValue(int column_index, T & s) {
+  size_t size = getBlobSize(column_index);
+  size_t offset = 0;
+  s.resize(size ? size : 4096);
+  while ( 1 ) {
+    if (offset == s.size()) s.resize(2 * s.size());
+    size_t n = readBlob(column_index, offset, &s[offset], s.size() - offset);
+    if (!n) break;
+    offset += n;
+    if (offset == size) break;
+  }
+  s.resize(offset);
+}
+
+// Generic struct mapping through the typed getters. Backends override these
+// to access their column data directly.
+void
+SQLStatement::fetchRow(const field_s * fields, unsigned int num_fields) {
+  if (num_fields > getNumFields()) {
+    throw SQLException(SQLException::BAD_COLUMN_INDEX, "", getQuery());
+  }
+  for (unsigned int i = 0; i < num_fields; i++) {
+    void * ptr = fields[i].ptr;
+    switch (fields[i].type) {
+    case FIELD_INT: *(int *)ptr = getInt(i); break;
+    case FIELD_UINT: *(unsigned int *)ptr = getUInt(i); break;
+    case FIELD_INT64: *(long long *)ptr = getLongLong(i); break;
+    case FIELD_DOUBLE: *(double *)ptr = getDouble(i); break;
+    case FIELD_BOOL: *(bool *)ptr = getBool(i); break;
+    case FIELD_TEXT: *(std::string *)ptr = getText(i); break;
+    case FIELD_BLOB: *(ustring *)ptr = getBlob(i); break;
+    }
+  }
+}
+
+void
+SQLStatement::bindRow(const field_s * fields, unsigned int num_fields) {
+  for (unsigned int i = 0; i < num_fields; i++) {
+    const void * ptr = fields[i].ptr;
+    switch (fields[i].type) {
+    case FIELD_INT: bind(*(const int *)ptr); break;
+    case FIELD_UINT: bind(*(const unsigned int *)ptr); break;
+    case FIELD_INT64: bind(*(const long long *)ptr); break;
+    case FIELD_DOUBLE: bind(*(const double *)ptr); break;
+    case FIELD_BOOL: bind(*(const bool *)ptr); break;
+    case FIELD_TEXT: bind(*(const std::string *)ptr); break;
+    case FIELD_BLOB: bind(*(const ustring *)ptr); break;
+    }
+  }
+}
+
+size_t
+SQLStatement::streamBlob(int column_index, std::ostream & output, size_t chunk_size) {
+  vector<char> buffer(chunk_size);
+  size_t offset = 0;
+  while ( 1 ) {
+    size_t n = readBlob(column_index, offset, buffer.data(), buffer.size());
+    if (!n) break;
+    output.write(buffer.data(), n);
+    offset += n;
+  }
+  return offset;
+}
+
+// Names are registered both with and without their prefix character
+void
+SQLStatement::addNamedParameter(const std::string & name, unsigned int index) {
+  if (name.empty()) return;
+  named_parameters[name].push_back(index);
+  if (name.size() > 1 && (name[0] == ':' || name[0] == '@' || name[0] == '$')) {
+    named_parameters[name.substr(1)].push_back(index);
+  }
+}
+
+static bool
+isIdentifierChar(char c, bool is_first) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (!is_first && c >= '0' && c <= '9');
+}
+
+// Returns the end of the quoted string or comment that starts at i, or i
+// if there is none
+static size_t
+skipQuotedText(const std::string & query, size_t i) {
+  size_t n = query.size();
+  char c = query[i];
+  if (c == '\'' || c == '"' || c == '`') {
+    size_t j = i + 1;
+    while (j < n) {
+      if (query[j] == '\\' && c != '`') {
+	j += 2;
+      } else if (query[j] == c) {
+	if (j + 1 < n && query[j + 1] == c) {
+	  j += 2;
+	} else {
+	  j++;
+	  break;
+	}
+      } else {
+	j++;
+      }
+    }
+    return j > n ? n : j;
+  } else if ((c == '-' && i + 1 < n && query[i + 1] == '-') || c == '#') {
+    size_t j = query.find('\n', i);
+    return j == string::npos ? n : j;
+  } else if (c == '/' && i + 1 < n && query[i + 1] == '*') {
+    size_t j = query.find("*/", i + 2);
+    return j == string::npos ? n : j + 2;
+  }
+  return i;
+}
+
+// The words of the query are compared outside quoted text and comments. A
+// WITH query is a SELECT if the statement after its common table
+// expressions is.
+bool
+SQLStatement::isSelect(const std::string & query) {
+  vector<pair<string, int> > words; // upper case word and nesting level
+  size_t i = 0, n = query.size();
+  int depth = 0;
+  while (i < n) {
+    char c = query[i];
+    size_t j = skipQuotedText(query, i);
+    if (j != i) {
+      i = j;
+    } else if (c == '(' || c == ')') {
+      depth += c == '(' ? 1 : -1;
+      i++;
+    } else if (isIdentifierChar(c, false)) {
+      string word;
+      for (; i < n && isIdentifierChar(query[i], false); i++) word += (char)toupper((unsigned char)query[i]);
+      words.push_back(make_pair(word, depth));
+    } else {
+      i++;
+    }
+  }
+  if (words.empty()) return false;
+
+  size_t main = 0;
+  if (words[0].first == "WITH") {
+    for (main = 1; main < words.size(); main++) {
+      auto & w = words[main];
+      if (w.second == words[0].second && (w.first == "SELECT" || w.first == "INSERT" || w.first == "UPDATE" || w.first == "DELETE" || w.first == "REPLACE")) break;
+    }
+    if (main == words.size()) return false;
+  }
+  if (words[main].first != "SELECT") return false;
+
+  for (auto & w : words) {
+    if (w.first == "INTO") return false;
+  }
+  return true;
+}
+
+// names receives one entry per placeholder (empty for ?). Quoted strings and
+// comments are copied as is.
+std::string
+SQLStatement::rewriteNamedParameters(const std::string & query, std::vector<std::string> & names) {
+  string r;
+  r.reserve(query.size());
+  size_t i = 0, n = query.size();
+  while (i < n) {
+    char c = query[i];
+    size_t j = skipQuotedText(query, i);
+    if (j != i) {
+      r.append(query, i, j - i);
+      i = j;
+    } else if (c == '?') {
+      names.push_back(string());
+      r += c;
+      i++;
+    } else if (c == ':' && i + 1 < n && isIdentifierChar(query[i + 1], true) && (i == 0 || query[i - 1] != ':')) {
+      j = i + 1;
+      while (j < n && isIdentifierChar(query[j], false)) j++;
+      names.push_back(query.substr(i, j - i));
+      r += '?';
+      i = j;
+    } else {
+      r += c;
+      i++;
+    }
+  }
+  return r;
+}
@@ -1,8 +1,19 @@
 #include "SQLite.h"
 
 #include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
 #include <cassert>
 #include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "SQLException.h"
 
@@ -91,16 +102,326 @@ SQLite::prepare(const string & query) {
     throw SQLException(SQLException::PREPARE_FAILED, sqlite3_errmsg(db));
   }
   assert(stmt);  
-  return std::make_shared<SQLiteStatement>(db, stmt);
+  auto sqlite_stmt = std::make_shared<SQLiteStatement>(db, stmt, createStatementTracker());
+  sqlite_stmt->setTimeout(getQueryTimeout());
+  if (full_scan_handler) {
+    for (auto & step : sqlite_stmt->explainPlan()) {
+      if (isFullScan(step.detail)) full_scan_handler(query, step.detail);
+    }
+  }
+  return sqlite_stmt;
+}
+
+static vector<SQLitePlanStep>
+explainQueryPlan(sqlite3 * db, const char * query) {
+  sqlite3_stmt * stmt = 0;
+  string explain_query = string("EXPLAIN QUERY PLAN ") + query;
+  if (sqlite3_prepare_v2(db, explain_query.c_str(), -1, &stmt, 0) != SQLITE_OK) {
+    throw SQLException(SQLException::PREPARE_FAILED, sqlite3_errmsg(db), query);
+  }
+  // columns are id, parent, notused and detail
+  vector<SQLitePlanStep> plan;
+  int r;
+  while ((r = sqlite3_step(stmt)) == SQLITE_ROW) {
+    const char * detail = (const char *)sqlite3_column_text(stmt, 3);
+    plan.push_back({ sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), detail ? detail : "" });
+  }
+  sqlite3_finalize(stmt);
+  if (r != SQLITE_DONE) {
+    throw SQLException(SQLException::DATABASE_ERROR, sqlite3_errmsg(db), query);
+  }
+  return plan;
+}
+
+vector<SQLitePlanStep>
+SQLite::explainPlan(const string & query) {
+  if (!db) {
+    throw SQLException(SQLException::PREPARE_FAILED);
+  }
+  return explainQueryPlan(db, query.c_str());
+}
+
+// Details are "SCAN t" or "SCAN TABLE t" in older versions, followed by
+// "USING INDEX i" when the scan is on an index
+bool
+SQLite::isFullScan(const string & detail) {
+  if (detail.compare(0, 5, "SCAN ") != 0) return false;
+  return detail.find(" USING ") == string::npos &&
+    detail.find("VIRTUAL TABLE") == string::npos &&
+    detail.find("CONSTANT ROW") == string::npos &&
+    detail.find("SUBQUERY") == string::npos &&
+    detail.find("(subquery") == string::npos;
+}
+
+bool
+SQLite::checkpoint(int mode, int * wal_frames, int * checkpointed_frames) {
+  if (!db) {
+    throw SQLException(SQLException::DATABASE_ERROR, "Not connected");
+  }
+  int num_frames = 0, num_checkpointed = 0;
+  int r = sqlite3_wal_checkpoint_v2(db, 0, mode, &num_frames, &num_checkpointed);
+  if (wal_frames) *wal_frames = num_frames;
+  if (checkpointed_frames) *checkpointed_frames = num_checkpointed;
+  if (r == SQLITE_BUSY || r == SQLITE_LOCKED) {
+    return false;
+  } else if (r != SQLITE_OK) {
+    throw SQLException(SQLException::DATABASE_ERROR, sqlite3_errmsg(db));
+  }
+  // a PASSIVE checkpoint returns SQLITE_OK when readers keep it from
+  // copying every frame
+  return num_checkpointed >= num_frames;
+}
+
+void
+SQLite::setAutoCheckpoint(int pages) {
+  if (db) sqlite3_wal_autocheckpoint(db, pages);
+}
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+sqlite3_snapshot *
+SQLite::getSnapshot() {
+  if (!db) {
+    throw SQLException(SQLException::DATABASE_ERROR, "Not connected");
+  }
+  begin();
+  sqlite3_snapshot * snapshot = 0;
+  if (sqlite3_snapshot_get(db, "main", &snapshot) != SQLITE_OK) {
+    commit();
+    return 0;
+  }
+  return snapshot;
+}
+
+void
+SQLite::openSnapshot(sqlite3_snapshot * snapshot) {
+  if (!db) {
+    throw SQLException(SQLException::DATABASE_ERROR, "Not connected");
+  }
+  // a new connection does not know that the database is in WAL mode until
+  // it has read from it
+  execute("PRAGMA application_id");
+  begin();
+  if (sqlite3_snapshot_open(db, "main", snapshot) != SQLITE_OK) {
+    string errmsg = sqlite3_errmsg(db);
+    rollback();
+    throw SQLException(SQLException::DATABASE_ERROR, errmsg);
+  }
+}
+#endif
+
+void
+SQLite::loadFromFile(const string & file) {
+  if (!db) {
+    throw SQLException(SQLException::DATABASE_ERROR, "Not connected");
+  }
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw SQLException(SQLException::DATABASE_ERROR, "Cannot open " + file + ": " + strerror(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size <= 0) {
+    ::close(fd);
+    throw SQLException(SQLException::DATABASE_ERROR, "Cannot read " + file);
+  }
+  size_t size = (size_t)st.st_size;
+  void * map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    throw SQLException(SQLException::DATABASE_ERROR, "Cannot map " + file + ": " + strerror(errno));
+  }
+  madvise(map, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+  // SQLite owns the copy and frees it when the database is closed
+  unsigned char * data = (unsigned char *)sqlite3_malloc64(size);
+  if (!data) {
+    munmap(map, size);
+    throw SQLException(SQLException::DATABASE_ERROR, "Out of memory");
+  }
+  memcpy(data, map, size);
+  munmap(map, size);
+
+  // in-memory databases cannot use WAL, so the header is switched to rollback mode
+  if (size >= 20 && data[18] == 2 && data[19] == 2) {
+    data[18] = data[19] = 1;
+  }
+
+  int r = sqlite3_deserialize(db, "main", data, size, size, SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE);
+  if (r != SQLITE_OK) {
+    // data has been freed by SQLite
+    throw SQLException(SQLException::DATABASE_ERROR, sqlite3_errmsg(db));
+  }
+}
+
+void
+SQLite::saveToFile(const string & file, int pages_per_step) {
+  if (!db) {
+    throw SQLException(SQLException::DATABASE_ERROR, "Not connected");
+  }
+  string tmp_file = file + ".tmp";
+  unlink(tmp_file.c_str());
+
+  sqlite3 * dest = 0;
+  if (sqlite3_open_v2(tmp_file.c_str(), &dest, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0) != SQLITE_OK) {
+    string errmsg = dest ? sqlite3_errmsg(dest) : "Cannot open " + tmp_file;
+    sqlite3_close(dest);
+    throw SQLException(SQLException::DATABASE_ERROR, errmsg);
+  }
+
+  sqlite3_backup * backup = sqlite3_backup_init(dest, "main", db, "main");
+  if (!backup) {
+    string errmsg = sqlite3_errmsg(dest);
+    sqlite3_close(dest);
+    unlink(tmp_file.c_str());
+    throw SQLException(SQLException::DATABASE_ERROR, errmsg);
+  }
+  int r;
+  while ( 1 ) {
+    r = sqlite3_backup_step(backup, pages_per_step > 0 ? pages_per_step : -1);
+    if (r == SQLITE_DONE) {
+      break;
+    } else if (r == SQLITE_OK) {
+      // let writers in between the steps
+      this_thread::yield();
+    } else if (r == SQLITE_BUSY || r == SQLITE_LOCKED) {
+      sqlite3_sleep(1);
+    } else {
+      break;
+    }
+  }
+  sqlite3_backup_finish(backup);
+  r = r == SQLITE_DONE ? sqlite3_errcode(dest) : r;
+  string errmsg = sqlite3_errmsg(dest);
+  sqlite3_close(dest);
+
+  if (r != SQLITE_OK) {
+    unlink(tmp_file.c_str());
+    throw SQLException(SQLException::DATABASE_ERROR, errmsg);
+  }
+  if (rename(tmp_file.c_str(), file.c_str()) == -1) {
+    string errmsg = strerror(errno);
+    unlink(tmp_file.c_str());
+    throw SQLException(SQLException::DATABASE_ERROR, "Cannot rename " + tmp_file + ": " + errmsg);
+  }
+}
+
+std::shared_ptr<SQLiteBlob>
+SQLite::openBlob(const string & table, const string & column, long long rowid, bool writable) {
+  if (!db) {
+    throw SQLException(SQLException::DATABASE_ERROR, "Not connected");
+  }
+  sqlite3_blob * blob = 0;
+  int r = sqlite3_blob_open(db, "main", table.c_str(), column.c_str(), (sqlite3_int64)rowid, writable ? 1 : 0, &blob);
+  if (r != SQLITE_OK) {
+    string errmsg = sqlite3_errmsg(db);
+    if (blob) sqlite3_blob_close(blob);
+    throw SQLException(SQLException::DATABASE_ERROR, errmsg);
+  }
+  return std::make_shared<SQLiteBlob>(db, blob);
+}
+
+void
+SQLite::registerFunction(const string & name, int num_args, bool is_deterministic, void * user_data,
+			 void (*func)(sqlite3_context *, int, sqlite3_value **),
+			 void (*step)(sqlite3_context *, int, sqlite3_value **),
+			 void (*final)(sqlite3_context *),
+			 void (*value)(sqlite3_context *),
+			 void (*inverse)(sqlite3_context *, int, sqlite3_value **),
+			 void (*destroy)(void *)) {
+  if (!db) {
+    destroy(user_data);
+    throw SQLException(SQLException::DATABASE_ERROR, "Not connected");
+  }
+  int flags = SQLITE_UTF8;
+  if (is_deterministic) flags |= SQLITE_DETERMINISTIC;
+  int r;
+  // the destructor is called by SQLite even if registration fails
+  if (value) {
+    r = sqlite3_create_window_function(db, name.c_str(), num_args, flags, user_data, step, final, value, inverse, destroy);
+  } else {
+    r = sqlite3_create_function_v2(db, name.c_str(), num_args, flags, user_data, func, step, final, destroy);
+  }
+  if (r != SQLITE_OK) {
+    throw SQLException(SQLException::DATABASE_ERROR, sqlite3_errmsg(db));
+  }
+}
+
+static void
+destroyVirtualTable(void * ptr) {
+  delete (SQLiteVirtualTable *)ptr;
 }
 
-SQLiteStatement::SQLiteStatement(sqlite3 * _db, sqlite3_stmt * _stmt) : db(_db), stmt(_stmt) {
+void
+SQLite::registerVirtualTable(const string & name, SQLiteVirtualTable * table) {
+  if (!db) {
+    delete table;
+    throw SQLException(SQLException::DATABASE_ERROR, "Not connected");
+  }
+  // the destructor is called by SQLite even if registration fails
+  int r = sqlite3_create_module_v2(db, name.c_str(), &SQLiteVirtualTable::module, table, destroyVirtualTable);
+  if (r != SQLITE_OK) {
+    throw SQLException(SQLException::DATABASE_ERROR, sqlite3_errmsg(db));
+  }
+}
+
+// Maps a declared column type to a type using the SQLite affinity rules
+static SQLStatement::ColumnType
+getDeclaredType(const char * decltype_str, size_t & size) {
+  size = 0;
+  if (!decltype_str) return SQLStatement::ANY;
+  string t;
+  for (const char * p = decltype_str; *p; p++) {
+    t += (char)toupper((unsigned char)*p);
+  }
+  size_t pos = t.find('(');
+  if (pos != string::npos) {
+    size = strtoul(t.c_str() + pos + 1, 0, 10);
+  }
+  if (t.find("INT") != string::npos) return SQLStatement::INT64;
+  if (t.find("CHAR") != string::npos || t.find("CLOB") != string::npos || t.find("TEXT") != string::npos) return SQLStatement::TEXT;
+  if (t.find("BLOB") != string::npos) return SQLStatement::BLOB;
+  if (t.find("REAL") != string::npos || t.find("FLOA") != string::npos || t.find("DOUB") != string::npos) return SQLStatement::DOUBLE;
+  if (t.find("DATE") != string::npos || t.find("TIME") != string::npos) return SQLStatement::DATETIME;
+  return SQLStatement::ANY;
+}
+
+SQLiteStatement::SQLiteStatement(sqlite3 * _db, sqlite3_stmt * _stmt, std::shared_ptr<MemoryTracker> tracker)
+  : SQLStatement(sqlite3_sql(_stmt)), db(_db), stmt(_stmt)
+{
   assert(db);
   assert(stmt);
+
+  if (tracker) {
+    setMemoryTracker(tracker);
+#ifdef SQLITE_STMTSTATUS_MEMUSED
+    // the compiled program of the statement
+    size_t memused = (size_t)sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_MEMUSED, 0);
+    try {
+      tracker->add(memused);
+    } catch (...) {
+      sqlite3_finalize(stmt);
+      throw;
+    }
+    tracked_memory = memused;
+#endif
+  }
+
+  int n = sqlite3_bind_parameter_count(stmt);
+  for (int i = 1; i <= n; i++) {
+    const char * name = sqlite3_bind_parameter_name(stmt, i);
+    if (name) addNamedParameter(name, i);
+  }
+
+  columns.resize(sqlite3_column_count(stmt));
+  for (unsigned int i = 0; i < columns.size(); i++) {
+    const char * name = sqlite3_column_name(stmt, i);
+    if (name) columns[i].name = name;
+    columns[i].type = getDeclaredType(sqlite3_column_decltype(stmt, i), columns[i].size);
+  }
 }
 
 SQLiteStatement::~SQLiteStatement() {
   if (stmt) sqlite3_finalize(stmt);
+  if (tracked_memory) getMemoryTracker()->remove(tracked_memory);
 }
 
 unsigned int
@@ -111,56 +432,110 @@ SQLiteStatement::execute() {
 
 void
 SQLiteStatement::step() {
+  int e = tryStep();
+  if (e) {
+    throw SQLException((SQLException::ErrorType)e, sqlite3_errmsg(db));
+  }
+}
+
+// Progress handler that interrupts the step once the statement has been
+// cancelled or the deadline has passed
+int
+SQLiteStatement::checkProgress(void * arg) {
+  SQLiteStatement * s = (SQLiteStatement *)arg;
+  if (s->is_cancelled) return 1;
+  return s->has_deadline && chrono::steady_clock::now() >= s->deadline ? 1 : 0;
+}
+
+// Returns zero or an SQLException::ErrorType
+int
+SQLiteStatement::tryStep() {
   results_available = false;
 
-  while ( 1 ) {
-    int r = sqlite3_step(stmt);
-    switch (r) {
-    case SQLITE_ROW:
-      results_available = true;
-      return;
-      
-    case SQLITE_DONE:
-      return;
+  if (!is_started) {
+    // the deadline covers all steps of one execution, and a cancel only
+    // applies to the execution during which it arrives
+    is_started = true;
+    is_cancelled = false;
+    has_deadline = getTimeout().count() > 0;
+    if (has_deadline) deadline = chrono::steady_clock::now() + getTimeout();
+  }
 
-    case SQLITE_BUSY:
-      cerr << "database is busy\n";
-      break;
+  // the handler is installed only for the duration of this step since
+  // the connection has one handler for all its statements
+  sqlite3_progress_handler(db, 1000, checkProgress, this);
+  int r = sqlite3_step(stmt);
+  sqlite3_progress_handler(db, 0, 0, 0);
+  // a finished or failed statement starts a new execution on the next step
+  if ((r & 0xff) != SQLITE_ROW) is_started = false;
+  switch (r & 0xff) {
+  case SQLITE_ROW:
+    results_available = true;
+    return 0;
       
-    case SQLITE_ERROR: throw SQLException(SQLException::DATABASE_ERROR, sqlite3_errmsg(db));
-    case SQLITE_MISUSE: throw SQLException(SQLException::DATABASE_MISUSE, sqlite3_errmsg(db));
-    case SQLITE_CONSTRAINT: throw SQLException(SQLException::CONSTRAINT_VIOLATION, sqlite3_errmsg(db));
+  case SQLITE_DONE:
+    return 0;
+
+  case SQLITE_BUSY: // the busy timeout has already expired
+  case SQLITE_LOCKED:
+    return SQLException::DATABASE_BUSY;
       
-    default:
-      cerr << "unknown error: " << r << endl;
-      assert(0);
-      return;
+  case SQLITE_MISUSE: return SQLException::DATABASE_MISUSE;
+  case SQLITE_CONSTRAINT: return SQLException::CONSTRAINT_VIOLATION;
+  case SQLITE_SCHEMA: return SQLException::SCHEMA_CHANGED;
+
+  case SQLITE_NOMEM:
+  case SQLITE_FULL:
+  case SQLITE_TOOBIG:
+    return SQLException::RESOURCE_LIMIT;
+
+  case SQLITE_INTERRUPT:
+    // an interrupted statement stays active and keeps the interrupt of
+    // SQLite::cancel() in effect until it is reset
+    sqlite3_reset(stmt);
+    if (!is_cancelled && has_deadline && chrono::steady_clock::now() >= deadline) {
+      return SQLException::QUERY_TIMED_OUT;
     }
+    return SQLException::QUERY_CANCELLED;
+
+  default:
+    // SQLITE_ERROR, READONLY, IOERR, CORRUPT, ABORT, CANTOPEN etc.
+    return SQLException::DATABASE_ERROR;
   }
-  
-  throw SQLException(SQLException::QUERY_TIMED_OUT);
 }
 
+// sqlite3_reset() returns the error of the last step, which step() or
+// tryStep() has already reported, so only a schema change is raised here
 void
 SQLiteStatement::reset() {
   SQLStatement::reset();
+  is_started = false;
   
   int r = sqlite3_reset(stmt);
 
   switch (r) {
-  case SQLITE_OK: return;
-  
   case SQLITE_SCHEMA:
     throw SQLException(SQLException::SCHEMA_CHANGED, sqlite3_errmsg(db));
-    return;
     
   default:
-    cerr << "unknown error: " << r << endl;
-    assert(0);
     return;
   }
 }
 
+SQLStatus<unsigned int>
+SQLiteStatement::tryExecute() {
+  int e = tryStep();
+  if (e) return (SQLException::ErrorType)e;
+  return getAffectedRows();
+}
+
+SQLStatus<bool>
+SQLiteStatement::tryNext() {
+  int e = tryStep();
+  if (e) return (SQLException::ErrorType)e;
+  return results_available;
+}
+
 bool
 SQLiteStatement::next() {
   step();
@@ -277,6 +652,107 @@ SQLiteStatement::bind(const void* data, size_t len, bool is_defined = true) {
   return *this;
 }
 
+// SQLite has no streaming bind: the value is read into a single buffer that is
+// handed over to SQLite without a second copy. Use bindZeroBlob() and
+// SQLite::openBlob() to upload with memory bounded by the chunk size.
+SQLiteStatement &
+SQLiteStatement::bindStream(std::istream & input, size_t len, bool is_defined) {
+  assert(stmt);
+  unsigned int index = getNextBindIndex();
+  if (is_defined) {
+    char * data = (char *)sqlite3_malloc64(len ? len : 1);
+    if (!data) {
+      throw SQLException(SQLException::BIND_FAILED, "Out of memory");
+    }
+    input.read(data, len);
+    int r = sqlite3_bind_blob64(stmt, index, data, (sqlite3_uint64)input.gcount(), sqlite3_free);
+    if (r != SQLITE_OK) {
+      throw SQLException(SQLException::BIND_FAILED, sqlite3_errmsg(db));
+    }
+  }
+  return *this;
+}
+
+SQLiteStatement &
+SQLiteStatement::bindZeroBlob(size_t len, bool is_defined) {
+  assert(stmt);
+  unsigned int index = getNextBindIndex();
+  if (is_defined) {
+    int r = sqlite3_bind_zeroblob64(stmt, index, (sqlite3_uint64)len);
+    if (r != SQLITE_OK) {
+      throw SQLException(SQLException::BIND_FAILED, sqlite3_errmsg(db));
+    }
+  }
+  return *this;
+}
+
+void
+SQLiteStatement::bindRow(const field_s * fields, unsigned int num_fields) {
+  assert(stmt);
+  for (unsigned int i = 0; i < num_fields; i++) {
+    unsigned int index = getNextBindIndex();
+    const void * ptr = fields[i].ptr;
+    int r = SQLITE_OK;
+    switch (fields[i].type) {
+    case FIELD_INT: r = sqlite3_bind_int(stmt, index, *(const int *)ptr); break;
+    case FIELD_UINT: r = sqlite3_bind_int64(stmt, index, *(const unsigned int *)ptr); break;
+    case FIELD_INT64: r = sqlite3_bind_int64(stmt, index, (sqlite_int64)*(const long long *)ptr); break;
+    case FIELD_DOUBLE: r = sqlite3_bind_double(stmt, index, *(const double *)ptr); break;
+    case FIELD_BOOL: r = sqlite3_bind_int(stmt, index, *(const bool *)ptr ? 1 : 0); break;
+    case FIELD_TEXT:
+      {
+	const std::string & s = *(const std::string *)ptr;
+	r = sqlite3_bind_text(stmt, index, s.data(), (int)s.size(), SQLITE_TRANSIENT);
+      }
+      break;
+    case FIELD_BLOB:
+      {
+	const ustring & s = *(const ustring *)ptr;
+	r = sqlite3_bind_blob(stmt, index, s.data(), (int)s.size(), SQLITE_TRANSIENT);
+      }
+      break;
+    }
+    if (r != SQLITE_OK) {
+      throw SQLException(SQLException::BIND_FAILED, sqlite3_errmsg(db));
+    }
+  }
+}
+
+void
+SQLiteStatement::fetchRow(const field_s * fields, unsigned int num_fields) {
+  assert(stmt);
+  if ((int)num_fields > sqlite3_column_count(stmt)) {
+    throw SQLException(SQLException::BAD_COLUMN_INDEX, "", getQuery());
+  }
+  if (!results_available) {
+    return;
+  }
+  for (unsigned int i = 0; i < num_fields; i++) {
+    void * ptr = fields[i].ptr;
+    switch (fields[i].type) {
+    case FIELD_INT: *(int *)ptr = sqlite3_column_int(stmt, i); break;
+    case FIELD_UINT: *(unsigned int *)ptr = (unsigned int)sqlite3_column_int64(stmt, i); break;
+    case FIELD_INT64: *(long long *)ptr = sqlite3_column_int64(stmt, i); break;
+    case FIELD_DOUBLE: *(double *)ptr = sqlite3_column_double(stmt, i); break;
+    case FIELD_BOOL: *(bool *)ptr = sqlite3_column_int(stmt, i) != 0; break;
+    case FIELD_TEXT:
+      {
+	const char * s = (const char *)sqlite3_column_text(stmt, i);
+	if (s) ((std::string *)ptr)->assign(s, sqlite3_column_bytes(stmt, i));
+	else ((std::string *)ptr)->clear();
+      }
+      break;
+    case FIELD_BLOB:
+      {
+	const unsigned char * s = (const unsigned char *)sqlite3_column_blob(stmt, i);
+	if (s) ((ustring *)ptr)->assign(s, sqlite3_column_bytes(stmt, i));
+	else ((ustring *)ptr)->clear();
+      }
+      break;
+    }
+  }
+}
+
 int
 SQLiteStatement::getInt(int column_index) {
   assert(stmt);
@@ -343,6 +819,56 @@ SQLiteStatement::getBlob(int column_index) {
   }
 }
 
+size_t
+SQLiteStatement::getBlobSize(int column_index) {
+  assert(stmt);
+  if (results_available) {
+    return sqlite3_column_bytes(stmt, column_index);
+  }
+  return 0;
+}
+
+size_t
+SQLiteStatement::readBlob(int column_index, size_t offset, void * buffer, size_t len) {
+  assert(stmt);
+  if (!results_available) {
+    return 0;
+  }
+  const char * data = (const char *)sqlite3_column_blob(stmt, column_index);
+  size_t total = sqlite3_column_bytes(stmt, column_index);
+  if (!data || offset >= total) {
+    return 0;
+  }
+  if (len > total - offset) len = total - offset;
+  memcpy(buffer, data + offset, len);
+  return len;
+}
+
+// Columns without a declared type, such as expressions, get the type of the
+// value in the current row
+SQLStatement::ColumnType
+SQLiteStatement::getColumnType(int column_index) {
+  ColumnType type = getColumnInfo(column_index).type;
+  if (type == ANY && results_available) {
+    switch (sqlite3_column_type(stmt, column_index)) {
+    case SQLITE_INTEGER: return INT64;
+    case SQLITE_FLOAT: return DOUBLE;
+    case SQLITE_TEXT: return TEXT;
+    case SQLITE_BLOB: return BLOB;
+    }
+  }
+  return type;
+}
+
+bool
+SQLiteStatement::isNull(int column_index) {
+  assert(stmt);
+  if (results_available) {
+    return sqlite3_column_type(stmt, column_index) == SQLITE_NULL;
+  }
+  return true;
+}
+
 unsigned int
 SQLiteStatement::getNumFields() {
   assert(stmt);
@@ -358,3 +884,100 @@ unsigned int
 SQLiteStatement::getAffectedRows() const {
   return sqlite3_changes(db);
 }
+
+SQLiteStatementStatus
+SQLiteStatement::getStatus(bool reset_counters) {
+  int r = reset_counters ? 1 : 0;
+  SQLiteStatementStatus status;
+  status.fullscan_steps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, r);
+  status.sorts = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, r);
+  status.autoindexes = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, r);
+  status.vm_steps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, r);
+#ifdef SQLITE_STMTSTATUS_REPREPARE
+  status.reprepares = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_REPREPARE, r);
+  status.runs = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_RUN, r);
+#endif
+#ifdef SQLITE_STMTSTATUS_MEMUSED
+  // not a counter, so it is never reset
+  status.memused = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_MEMUSED, 0);
+#endif
+  return status;
+}
+
+vector<SQLitePlanStep>
+SQLiteStatement::explainPlan() {
+  return explainQueryPlan(db, sqlite3_sql(stmt));
+}
+
+SQLiteBlob::SQLiteBlob(sqlite3 * _db, sqlite3_blob * _blob) : db(_db), blob(_blob) {
+  assert(db);
+  assert(blob);
+}
+
+SQLiteBlob::~SQLiteBlob() {
+  if (blob) sqlite3_blob_close(blob);
+}
+
+size_t
+SQLiteBlob::size() const {
+  return sqlite3_blob_bytes(blob);
+}
+
+size_t
+SQLiteBlob::read(size_t offset, void * buffer, size_t len) {
+  size_t total = size();
+  if (offset >= total) {
+    return 0;
+  }
+  if (len > total - offset) len = total - offset;
+  int r = sqlite3_blob_read(blob, buffer, (int)len, (int)offset);
+  if (r != SQLITE_OK) {
+    throw SQLException(SQLException::GET_FAILED, sqlite3_errmsg(db));
+  }
+  return len;
+}
+
+void
+SQLiteBlob::write(size_t offset, const void * data, size_t len) {
+  int r = sqlite3_blob_write(blob, data, (int)len, (int)offset);
+  if (r != SQLITE_OK) {
+    throw SQLException(SQLException::EXECUTE_FAILED, sqlite3_errmsg(db));
+  }
+}
+
+void
+SQLiteBlob::reopen(long long rowid) {
+  int r = sqlite3_blob_reopen(blob, (sqlite3_int64)rowid);
+  if (r != SQLITE_OK) {
+    throw SQLException(SQLException::DATABASE_ERROR, sqlite3_errmsg(db));
+  }
+}
+
+size_t
+SQLiteBlob::read(std::ostream & output, size_t chunk_size) {
+  vector<char> buffer(chunk_size);
+  size_t offset = 0;
+  while ( 1 ) {
+    size_t n = read(offset, buffer.data(), buffer.size());
+    if (!n) break;
+    output.write(buffer.data(), n);
+    offset += n;
+  }
+  return offset;
+}
+
+// The blob cannot grow: at most size() bytes are copied from input
+size_t
+SQLiteBlob::write(std::istream & input, size_t chunk_size) {
+  vector<char> buffer(chunk_size);
+  size_t offset = 0, total = size();
+  while (offset < total && input) {
+    size_t len = total - offset < chunk_size ? total - offset : chunk_size;
+    input.read(buffer.data(), len);
+    size_t n = (size_t)input.gcount();
+    if (!n) break;
+    write(offset, buffer.data(), n);
+    offset += n;
+  }
+  return offset;
+}
@@ -0,0 +1,92 @@
+#include "SQLiteMaintenance.h"
+
+#include <sys/stat.h>
+
+using namespace std;
+using namespace sqldb;
+
+SQLiteMaintenance::SQLiteMaintenance(const std::string & _db_file, const SQLiteMaintenanceOptions & _options)
+  : db_file(_db_file),
+    options(_options)
+{
+  db = make_unique<SQLite>(db_file);
+  // commits of the incremental vacuum must not checkpoint either
+  db->setAutoCheckpoint(0);
+  // the WAL is opened with the first read, before that checkpoints are no-ops
+  db->execute("SELECT 1 FROM sqlite_master LIMIT 1");
+  thread = std::thread([this] { run(); });
+}
+
+SQLiteMaintenance::~SQLiteMaintenance() {
+  {
+    lock_guard<std::mutex> guard(stop_mutex);
+    is_stopping = true;
+  }
+  stop_cond.notify_all();
+  thread.join();
+}
+
+size_t
+SQLiteMaintenance::getWALSize() const {
+  struct stat st;
+  if (stat((db_file + "-wal").c_str(), &st) == -1) return 0;
+  return (size_t)st.st_size;
+}
+
+bool
+SQLiteMaintenance::checkpoint(int mode) {
+  lock_guard<std::mutex> guard(mutex);
+  stats.wal_size = getWALSize();
+
+  int wal_frames = 0, checkpointed_frames = 0;
+  auto t0 = chrono::steady_clock::now();
+  bool r = db->checkpoint(mode, &wal_frames, &checkpointed_frames);
+  unsigned long long us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t0).count();
+
+  stats.checkpoints++;
+  if (!r) stats.blocked_checkpoints++;
+  stats.checkpoint_time_us += us;
+  stats.last_checkpoint_us = us;
+  unsigned long long max_us = stats.max_checkpoint_us;
+  while (us > max_us && !stats.max_checkpoint_us.compare_exchange_weak(max_us, us)) { }
+  stats.wal_frames = wal_frames;
+  stats.checkpointed_frames = checkpointed_frames;
+  return r;
+}
+
+void
+SQLiteMaintenance::optimize() {
+  lock_guard<std::mutex> guard(mutex);
+  db->execute("PRAGMA optimize");
+  if (options.incremental_vacuum_pages) {
+    // each step frees one page
+    auto stmt = db->prepare("PRAGMA incremental_vacuum(" + to_string(options.incremental_vacuum_pages) + ")");
+    while (stmt->next()) { }
+  }
+  stats.optimizations++;
+}
+
+void
+SQLiteMaintenance::run() {
+  auto next_optimize = chrono::steady_clock::now() + options.optimize_interval;
+  while ( 1 ) {
+    {
+      unique_lock<std::mutex> lock(stop_mutex);
+      if (stop_cond.wait_for(lock, options.checkpoint_interval, [this] { return is_stopping; })) break;
+    }
+
+    try {
+      size_t wal_size = getWALSize();
+      if (wal_size && wal_size >= options.wal_size_threshold) {
+	bool is_over_limit = options.wal_size_limit && wal_size > options.wal_size_limit;
+	checkpoint(is_over_limit ? SQLITE_CHECKPOINT_TRUNCATE : options.checkpoint_mode);
+      }
+      if (options.optimize_interval.count() && chrono::steady_clock::now() >= next_optimize) {
+	optimize();
+	next_optimize = chrono::steady_clock::now() + options.optimize_interval;
+      }
+    } catch (SQLException & e) {
+      stats.errors++;
+    }
+  }
+}
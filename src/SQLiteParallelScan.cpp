@@ -0,0 +1,86 @@
+#include "SQLiteParallelScan.h"
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+
+using namespace std;
+using namespace sqldb;
+
+std::vector<std::pair<long long, long long> >
+sqldb::getKeyRanges(SQLite & db, const std::string & table, const std::string & key_column, size_t num_ranges) {
+  vector<pair<long long, long long> > ranges;
+  auto stmt = db.prepare("SELECT min(" + key_column + "), max(" + key_column + ") FROM \"" + table + "\"");
+  if (!stmt->next() || stmt->isNull(0) || !num_ranges) {
+    return ranges;
+  }
+  long long min_key = stmt->getLongLong(0), max_key = stmt->getLongLong(1);
+
+  // unsigned arithmetic avoids overflow when the keys span the whole range
+  unsigned long long span = (unsigned long long)max_key - (unsigned long long)min_key;
+  unsigned long long width = span / num_ranges + 1;
+  for (unsigned long long lo = 0; ; lo += width) {
+    unsigned long long hi = span - lo < width ? span : lo + width - 1;
+    ranges.push_back(make_pair((long long)((unsigned long long)min_key + lo), (long long)((unsigned long long)min_key + hi)));
+    if (hi == span) break;
+  }
+  return ranges;
+}
+
+unsigned int
+sqldb::getNumScanWorkers(const ParallelScanOptions & options) {
+  unsigned int n = options.num_threads ? options.num_threads : thread::hardware_concurrency();
+  return n ? n : 1;
+}
+
+void
+sqldb::runParallelScan(const std::string & db_file, const std::string & table, const std::string & query,
+		       const ParallelScanOptions & options,
+		       const std::function<void (unsigned int worker, SQLStatement & stmt)> & func) {
+  unsigned int num_workers = getNumScanWorkers(options);
+  SQLite db(db_file, true);
+#ifdef SQLITE_ENABLE_SNAPSHOT
+  // the ranges and all workers read one snapshot, which the open transaction
+  // of this connection keeps from being checkpointed away
+  unique_ptr<sqlite3_snapshot, void (*)(sqlite3_snapshot *)> snapshot(db.getSnapshot(), sqlite3_snapshot_free);
+#endif
+  vector<pair<long long, long long> > ranges = getKeyRanges(db, table, options.key_column, (size_t)num_workers * (options.ranges_per_thread ? options.ranges_per_thread : 1));
+
+  // ranges are taken in order so that neighbouring pages are read together
+  atomic<size_t> next_range(0);
+  vector<exception_ptr> errors(num_workers);
+  vector<thread> workers;
+  for (unsigned int worker = 0; worker < num_workers; worker++) {
+    workers.emplace_back([&, worker] {
+      try {
+	SQLite db(db_file, true);
+	if (options.setup) options.setup(db);
+#ifdef SQLITE_ENABLE_SNAPSHOT
+	if (snapshot) db.openSnapshot(snapshot.get());
+#endif
+	auto stmt = db.prepare(query);
+	unsigned int lo = stmt->getParameterIndex(":lo"), hi = stmt->getParameterIndex(":hi");
+	if (!lo || !hi) {
+	  throw SQLException(SQLException::BAD_BIND_INDEX, "Scan query needs :lo and :hi", query);
+	}
+	while ( 1 ) {
+	  size_t i = next_range++;
+	  if (i >= ranges.size()) break;
+	  stmt->reset();
+	  stmt->bindNamed(":lo", ranges[i].first);
+	  stmt->bindNamed(":hi", ranges[i].second);
+	  func(worker, *stmt);
+	}
+      } catch (...) {
+	errors[worker] = current_exception();
+	// the other workers stop after their current range
+	next_range = ranges.size();
+      }
+    });
+  }
+  for (auto & t : workers) t.join();
+  for (auto & e : errors) {
+    if (e) rethrow_exception(e);
+  }
+}
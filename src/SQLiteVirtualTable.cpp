@@ -0,0 +1,254 @@
+#include "SQLiteVirtualTable.h"
+
+#include "SQLException.h"
+#include "ustring.h"
+
+#include <cmath>
+#include <new>
+
+using namespace std;
+using namespace sqldb;
+
+// Eponymous-only module: xCreate is null so the table exists in every schema
+// under the module name without CREATE VIRTUAL TABLE. The members are
+// assigned by name since later SQLite versions add fields to the struct.
+sqlite3_module SQLiteVirtualTable::module = [] {
+  sqlite3_module m = { };
+  m.xConnect = SQLiteVirtualTable::xConnect;
+  m.xBestIndex = SQLiteVirtualTable::xBestIndex;
+  m.xDisconnect = SQLiteVirtualTable::xDisconnect;
+  m.xOpen = SQLiteVirtualTable::xOpen;
+  m.xClose = SQLiteVirtualTable::xClose;
+  m.xFilter = SQLiteVirtualTable::xFilter;
+  m.xNext = SQLiteVirtualTable::xNext;
+  m.xEof = SQLiteVirtualTable::xEof;
+  m.xColumn = SQLiteVirtualTable::xColumn;
+  m.xRowid = SQLiteVirtualTable::xRowid;
+  return m;
+}();
+
+static const char *
+getDeclaredType(FieldType type) {
+  switch (type) {
+  case FIELD_INT:
+  case FIELD_UINT:
+  case FIELD_INT64:
+  case FIELD_BOOL: return "INTEGER";
+  case FIELD_DOUBLE: return "REAL";
+  case FIELD_TEXT: return "TEXT";
+  case FIELD_BLOB: return "BLOB";
+  }
+  return "";
+}
+
+SQLiteVirtualTable::SQLiteVirtualTable(const vector<string> & _column_names, const vector<FieldType> & _column_types,
+				       size_t _num_rows, std::function<void (size_t, field_s *)> _get_row, int _key_column)
+  : column_names(_column_names),
+    column_types(_column_types),
+    num_rows(_num_rows),
+    get_row(_get_row),
+    key_column(_key_column)
+{
+  if (column_names.size() != column_types.size()) {
+    throw SQLException(SQLException::DATABASE_MISUSE, "Column names do not match the struct mapping");
+  }
+  if (key_column >= (int)column_types.size()) {
+    throw SQLException(SQLException::BAD_COLUMN_INDEX, "Bad key column");
+  }
+
+  schema = "CREATE TABLE x(";
+  for (size_t i = 0; i < column_names.size(); i++) {
+    if (i) schema += ", ";
+    schema += "\"" + column_names[i] + "\" " + getDeclaredType(column_types[i]);
+  }
+  schema += ")";
+
+  if (key_column >= 0) {
+    vector<field_s> fields(column_types.size());
+    FieldType type = column_types[key_column];
+    for (size_t row = 0; row < num_rows; row++) {
+      get_row(row, fields.data());
+      const void * ptr = fields[key_column].ptr;
+      switch (type) {
+      case FIELD_INT: int_index.emplace(*(const int *)ptr, row); break;
+      case FIELD_UINT: int_index.emplace(*(const unsigned int *)ptr, row); break;
+      case FIELD_INT64: int_index.emplace(*(const long long *)ptr, row); break;
+      case FIELD_TEXT: text_index.emplace(*(const string *)ptr, row); break;
+      case FIELD_BLOB:
+	{
+	  const ustring & s = *(const ustring *)ptr;
+	  text_index.emplace(string((const char *)s.data(), s.size()), row);
+	}
+	break;
+      default:
+	throw SQLException(SQLException::DATABASE_MISUSE, "Unsupported key column type");
+      }
+    }
+  }
+}
+
+void
+SQLiteVirtualTable::lookupKey(sqlite3_value * value, vector<size_t> & rows) const {
+  if (column_types[key_column] == FIELD_TEXT || column_types[key_column] == FIELD_BLOB) {
+    int type = sqlite3_value_type(value);
+    if (type != SQLITE_TEXT && type != SQLITE_BLOB) return;
+    const char * s = (const char *)sqlite3_value_blob(value);
+    auto range = text_index.equal_range(string(s ? s : "", sqlite3_value_bytes(value)));
+    for (auto it = range.first; it != range.second; it++) rows.push_back(it->second);
+  } else {
+    long long key;
+    int type = sqlite3_value_numeric_type(value);
+    if (type == SQLITE_INTEGER) {
+      key = sqlite3_value_int64(value);
+    } else if (type == SQLITE_FLOAT) {
+      double d = sqlite3_value_double(value);
+      if (d != floor(d)) return;
+      key = (long long)d;
+    } else {
+      return;
+    }
+    auto range = int_index.equal_range(key);
+    for (auto it = range.first; it != range.second; it++) rows.push_back(it->second);
+  }
+}
+
+int
+SQLiteVirtualTable::xConnect(sqlite3 * db, void * aux, int, const char * const *, sqlite3_vtab ** vtab, char **) {
+  SQLiteVirtualTable * table = (SQLiteVirtualTable *)aux;
+  int r = sqlite3_declare_vtab(db, table->getSchema().c_str());
+  if (r != SQLITE_OK) return r;
+  vtab_s * v = new vtab_s();
+  v->table = table;
+  *vtab = &v->base;
+  return SQLITE_OK;
+}
+
+int
+SQLiteVirtualTable::xDisconnect(sqlite3_vtab * vtab) {
+  delete (vtab_s *)vtab;
+  return SQLITE_OK;
+}
+
+// Prefers a rowid lookup, then a key lookup, and falls back to a full scan
+int
+SQLiteVirtualTable::xBestIndex(sqlite3_vtab * vtab, sqlite3_index_info * info) {
+  SQLiteVirtualTable * table = ((vtab_s *)vtab)->table;
+  int rowid_constraint = -1, key_constraint = -1;
+  for (int i = 0; i < info->nConstraint; i++) {
+    const auto & c = info->aConstraint[i];
+    if (!c.usable || c.op != SQLITE_INDEX_CONSTRAINT_EQ) continue;
+    if (c.iColumn == -1) rowid_constraint = i;
+    else if (c.iColumn == table->key_column && table->key_column >= 0) key_constraint = i;
+  }
+  if (rowid_constraint >= 0) {
+    info->idxNum = ROWID_LOOKUP;
+    info->aConstraintUsage[rowid_constraint].argvIndex = 1;
+    info->aConstraintUsage[rowid_constraint].omit = 1;
+    info->estimatedCost = 1;
+    info->estimatedRows = 1;
+    info->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+  } else if (key_constraint >= 0) {
+    info->idxNum = KEY_LOOKUP;
+    info->aConstraintUsage[key_constraint].argvIndex = 1;
+    info->aConstraintUsage[key_constraint].omit = 1;
+    info->estimatedCost = 2;
+    info->estimatedRows = 1;
+  } else {
+    info->idxNum = SCAN;
+    info->estimatedCost = (double)table->num_rows + 1;
+    info->estimatedRows = (sqlite3_int64)table->num_rows;
+  }
+  return SQLITE_OK;
+}
+
+int
+SQLiteVirtualTable::xOpen(sqlite3_vtab * vtab, sqlite3_vtab_cursor ** cursor) {
+  cursor_s * c = new cursor_s();
+  c->table = ((vtab_s *)vtab)->table;
+  c->use_matches = false;
+  c->pos = c->end = 0;
+  c->fields.resize(c->table->column_types.size());
+  c->fields_row = (size_t)-1;
+  *cursor = &c->base;
+  return SQLITE_OK;
+}
+
+int
+SQLiteVirtualTable::xClose(sqlite3_vtab_cursor * cursor) {
+  delete (cursor_s *)cursor;
+  return SQLITE_OK;
+}
+
+int
+SQLiteVirtualTable::xFilter(sqlite3_vtab_cursor * cursor, int idx_num, const char *, int, sqlite3_value ** argv) {
+  cursor_s * c = (cursor_s *)cursor;
+  SQLiteVirtualTable * table = c->table;
+  c->matches.clear();
+  c->use_matches = idx_num != SCAN;
+  c->pos = 0;
+  if (idx_num == ROWID_LOOKUP) {
+    if (sqlite3_value_numeric_type(argv[0]) == SQLITE_INTEGER) {
+      sqlite3_int64 rowid = sqlite3_value_int64(argv[0]);
+      if (rowid >= 0 && (size_t)rowid < table->num_rows) c->matches.push_back((size_t)rowid);
+    }
+  } else if (idx_num == KEY_LOOKUP) {
+    try {
+      table->lookupKey(argv[0], c->matches);
+    } catch (std::bad_alloc &) {
+      return SQLITE_NOMEM;
+    }
+  }
+  c->end = c->use_matches ? c->matches.size() : table->num_rows;
+  return SQLITE_OK;
+}
+
+int
+SQLiteVirtualTable::xNext(sqlite3_vtab_cursor * cursor) {
+  ((cursor_s *)cursor)->pos++;
+  return SQLITE_OK;
+}
+
+int
+SQLiteVirtualTable::xEof(sqlite3_vtab_cursor * cursor) {
+  cursor_s * c = (cursor_s *)cursor;
+  return c->pos >= c->end;
+}
+
+int
+SQLiteVirtualTable::xRowid(sqlite3_vtab_cursor * cursor, sqlite3_int64 * rowid) {
+  cursor_s * c = (cursor_s *)cursor;
+  *rowid = (sqlite3_int64)(c->use_matches ? c->matches[c->pos] : c->pos);
+  return SQLITE_OK;
+}
+
+// Values are returned without copying since the rows outlive the statement
+int
+SQLiteVirtualTable::xColumn(sqlite3_vtab_cursor * cursor, sqlite3_context * ctx, int column_index) {
+  cursor_s * c = (cursor_s *)cursor;
+  size_t row = c->use_matches ? c->matches[c->pos] : c->pos;
+  if (c->fields_row != row) {
+    c->table->get_row(row, c->fields.data());
+    c->fields_row = row;
+  }
+  const void * ptr = c->fields[column_index].ptr;
+  switch (c->fields[column_index].type) {
+  case FIELD_INT: sqlite3_result_int(ctx, *(const int *)ptr); break;
+  case FIELD_UINT: sqlite3_result_int64(ctx, *(const unsigned int *)ptr); break;
+  case FIELD_INT64: sqlite3_result_int64(ctx, *(const long long *)ptr); break;
+  case FIELD_DOUBLE: sqlite3_result_double(ctx, *(const double *)ptr); break;
+  case FIELD_BOOL: sqlite3_result_int(ctx, *(const bool *)ptr ? 1 : 0); break;
+  case FIELD_TEXT:
+    {
+      const string & s = *(const string *)ptr;
+      sqlite3_result_text64(ctx, s.data(), s.size(), SQLITE_STATIC, SQLITE_UTF8);
+    }
+    break;
+  case FIELD_BLOB:
+    {
+      const ustring & s = *(const ustring *)ptr;
+      sqlite3_result_blob64(ctx, s.data(), s.size(), SQLITE_STATIC);
+    }
+    break;
+  }
+  return SQLITE_OK;
+}
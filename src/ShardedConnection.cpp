@@ -0,0 +1,310 @@
+#include "ShardedConnection.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <future>
+
+using namespace std;
+using namespace sqldb;
+
+static size_t
+fnv1a(const std::string & key) {
+  uint64_t h = 14695981039346656037ULL;
+  for (unsigned char c : key) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return (size_t)h;
+}
+
+ShardedConnection::ShardedConnection(std::vector<std::shared_ptr<Connection> > _shards, size_t num_threads)
+  : shards(std::move(_shards))
+{
+  if (shards.empty()) {
+    throw SQLException(SQLException::DATABASE_MISUSE, "No shards");
+  }
+  pool = make_shared<ThreadPool>(num_threads ? num_threads : shards.size());
+}
+
+size_t
+ShardedConnection::getShardIndex(const std::string & key) const {
+  size_t h = shard_function ? shard_function(key) : fnv1a(key);
+  return h % shards.size();
+}
+
+void
+ShardedConnection::forEachShard(const std::function<void (size_t)> & func) {
+  vector<future<void> > r;
+  for (size_t i = 0; i < shards.size(); i++) {
+    r.push_back(pool->submit([&func, i]() { func(i); }));
+  }
+  // every call must finish before func goes out of scope
+  exception_ptr error;
+  for (auto & f : r) {
+    try {
+      f.get();
+    } catch (...) {
+      if (!error) error = current_exception();
+    }
+  }
+  if (error) rethrow_exception(error);
+}
+
+void
+ShardedConnection::checkSelect(const string & query) const {
+  if (!SQLStatement::isSelect(query)) {
+    throw SQLException(SQLException::DATABASE_MISUSE, "Only SELECTs run on all shards, use prepareForKey() or prepareForAllShards()", query);
+  }
+}
+
+std::shared_ptr<SQLStatement>
+ShardedConnection::prepare(const string & query) {
+  checkSelect(query);
+  return make_shared<ShardedStatement>(*this, query, vector<MergeKey>());
+}
+
+std::shared_ptr<SQLStatement>
+ShardedConnection::prepare(const string & query, const std::vector<MergeKey> & order_by) {
+  checkSelect(query);
+  return make_shared<ShardedStatement>(*this, query, order_by);
+}
+
+std::shared_ptr<SQLStatement>
+ShardedConnection::prepareForAllShards(const string & query) {
+  return make_shared<ShardedStatement>(*this, query, vector<MergeKey>());
+}
+
+void
+ShardedConnection::begin() {
+  forEachShard([this](size_t i) { shards[i]->begin(); });
+}
+
+void
+ShardedConnection::commit() {
+  forEachShard([this](size_t i) { shards[i]->commit(); });
+}
+
+void
+ShardedConnection::rollback() {
+  forEachShard([this](size_t i) { shards[i]->rollback(); });
+}
+
+unsigned int
+ShardedConnection::execute(const char * query) {
+  checkSelect(query);
+  return executeOnAllShards(query);
+}
+
+unsigned int
+ShardedConnection::executeOnAllShards(const string & query) {
+  vector<unsigned int> r(shards.size());
+  forEachShard([&](size_t i) { r[i] = shards[i]->execute(query); });
+  unsigned int total = 0;
+  for (auto n : r) total += n;
+  return total;
+}
+
+bool
+ShardedConnection::ping() {
+  vector<char> r(shards.size());
+  forEachShard([&](size_t i) { r[i] = shards[i]->ping(); });
+  return find(r.begin(), r.end(), 0) == r.end();
+}
+
+// Called from another thread, so the shards are not run on the pool
+void
+ShardedConnection::cancel() {
+  for (auto & shard : shards) shard->cancel();
+}
+
+ShardedStatement::ShardedStatement(ShardedConnection & _conn, const std::string & query, const std::vector<MergeKey> & _order_by)
+  : SQLStatement(query),
+    conn(_conn),
+    stmts(_conn.getNumShards()),
+    order_by(_order_by)
+{
+  conn.forEachShard([&](size_t i) { stmts[i] = conn.getShard(i).prepare(query); });
+
+  vector<string> parameter_names;
+  rewriteNamedParameters(getQuery(), parameter_names);
+  for (unsigned int i = 0; i < parameter_names.size(); i++) {
+    addNamedParameter(parameter_names[i], i + 1);
+  }
+
+  unsigned int num_fields = stmts[0]->getNumFields();
+  columns.resize(num_fields);
+  for (unsigned int i = 0; i < num_fields; i++) {
+    columns[i].name = stmts[0]->getColumnName(i);
+    columns[i].type = stmts[0]->getColumnType(i);
+    columns[i].size = stmts[0]->getColumnSize(i);
+  }
+  for (auto & key : order_by) {
+    if (key.column_index < 0 || key.column_index >= (int)num_fields) {
+      throw SQLException(SQLException::BAD_COLUMN_INDEX, "Bad merge column", getQuery());
+    }
+  }
+}
+
+void
+ShardedStatement::setTimeout(std::chrono::milliseconds _timeout) {
+  SQLStatement::setTimeout(_timeout);
+  for (auto & stmt : stmts) stmt->setTimeout(_timeout);
+}
+
+void
+ShardedStatement::cancel() {
+  for (auto & stmt : stmts) stmt->cancel();
+}
+
+// Streams cannot be read once per shard
+ShardedStatement &
+ShardedStatement::bindStream(std::istream &, size_t, bool) {
+  throw SQLException(SQLException::BIND_FAILED, "Streams cannot be bound to sharded statements", getQuery());
+}
+
+void
+ShardedStatement::applyBinds(SQLStatement & stmt) {
+  stmt.reset();
+  for (unsigned int i = 0; i < binds.size(); i++) {
+    if (binds[i]) {
+      stmt.setBindIndex(i + 1);
+      binds[i](stmt);
+    }
+  }
+}
+
+unsigned int
+ShardedStatement::execute() {
+  vector<unsigned int> r(stmts.size());
+  conn.forEachShard([&](size_t i) {
+    applyBinds(*stmts[i]);
+    r[i] = stmts[i]->execute();
+  });
+  is_executed = true;
+  affected_rows = 0;
+  for (auto n : r) affected_rows += n;
+  return affected_rows;
+}
+
+// Fetches the first batch of every shard in parallel. With merge keys the
+// shards are then kept in a heap ordered by their next row.
+void
+ShardedStatement::gather() {
+  results.assign(stmts.size(), nullptr);
+  is_exhausted.assign(stmts.size(), false);
+  conn.forEachShard([&](size_t i) {
+    if (!is_executed) applyBinds(*stmts[i]);
+    results[i] = stmts[i]->fetchAll(batch_size);
+    is_exhausted[i] = results[i]->size() < batch_size;
+  });
+  is_executed = is_gathered = true;
+  positions.assign(stmts.size(), 0);
+  heap.clear();
+  current_shard = 0;
+  if (!order_by.empty()) {
+    for (size_t i = 0; i < results.size(); i++) {
+      if (!results[i]->empty()) heap.push_back(i);
+    }
+    make_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return isBefore(b, a); });
+  }
+}
+
+// Replaces a consumed batch with the next one from the shard. Returns false
+// when the shard has no rows left.
+bool
+ShardedStatement::refill(size_t shard) {
+  if (positions[shard] < results[shard]->size()) return true;
+  if (is_exhausted[shard]) return false;
+  results[shard] = stmts[shard]->fetchAll(batch_size);
+  positions[shard] = 0;
+  is_exhausted[shard] = results[shard]->size() < batch_size;
+  return !results[shard]->empty();
+}
+
+bool
+ShardedStatement::isBefore(size_t a, size_t b) const {
+  for (auto & key : order_by) {
+    int r = results[a]->compare(positions[a], key.column_index, *results[b], positions[b], key.column_index);
+    if (r) return key.descending ? r > 0 : r < 0;
+  }
+  // ties keep the shard order
+  return a < b;
+}
+
+bool
+ShardedStatement::next() {
+  if (!is_gathered) {
+    gather();
+  } else if (results_available) {
+    positions[current_shard]++;
+    if (!order_by.empty() && refill(current_shard)) {
+      heap.push_back(current_shard);
+      push_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return isBefore(b, a); });
+    }
+  }
+
+  if (!order_by.empty()) {
+    if (heap.empty()) {
+      results_available = false;
+    } else {
+      pop_heap(heap.begin(), heap.end(), [this](size_t a, size_t b) { return isBefore(b, a); });
+      current_shard = heap.back();
+      heap.pop_back();
+      results_available = true;
+    }
+  } else {
+    while (current_shard < results.size() && !refill(current_shard)) {
+      current_shard++;
+    }
+    results_available = current_shard < results.size();
+  }
+  return results_available;
+}
+
+void
+ShardedStatement::reset() {
+  SQLStatement::reset();
+  // ends the reads that are still open on the shards
+  for (auto & stmt : stmts) stmt->reset();
+  binds.clear();
+  results.clear();
+  positions.clear();
+  is_exhausted.clear();
+  heap.clear();
+  current_shard = 0;
+  is_executed = is_gathered = results_available = false;
+}
+
+const ResultSet &
+ShardedStatement::getResult() const {
+  if (!results_available) {
+    throw SQLException(SQLException::GET_FAILED, "No row", getQuery());
+  }
+  return *results[current_shard];
+}
+
+size_t
+ShardedStatement::getBlobSize(int column_index) {
+  const ResultSet & rs = getResult();
+  if (rs.isNull(getRow(), column_index)) return 0;
+  auto v = rs.getTextView(getRow(), column_index);
+  return v.data() ? v.size() : rs.getText(getRow(), column_index).size();
+}
+
+size_t
+ShardedStatement::readBlob(int column_index, size_t offset, void * buffer, size_t len) {
+  const ResultSet & rs = getResult();
+  if (rs.isNull(getRow(), column_index)) return 0;
+  string tmp;
+  auto v = rs.getTextView(getRow(), column_index);
+  if (!v.data()) {
+    tmp = rs.getText(getRow(), column_index);
+    v = tmp;
+  }
+  if (offset >= v.size()) return 0;
+  size_t n = min(len, v.size() - offset);
+  memcpy(buffer, v.data() + offset, n);
+  return n;
+}
@@ -0,0 +1,80 @@
+#include "StatementManifest.h"
+
+#include "SQLException.h"
+#include "ThreadPool.h"
+
+#include <exception>
+#include <future>
+
+using namespace std;
+using namespace sqldb;
+
+size_t
+StatementManifest::add(const string & name, const string & query) {
+  size_t id = queries.size();
+  if (!ids.emplace(name, id).second) {
+    throw SQLException(SQLException::PREPARE_FAILED, "Statement " + name + " already registered", query);
+  }
+  names.push_back(name);
+  queries.push_back(query);
+  return id;
+}
+
+size_t
+StatementManifest::getId(const string & name) const {
+  auto it = ids.find(name);
+  if (it == ids.end()) {
+    throw SQLException(SQLException::PREPARE_FAILED, "Unknown statement " + name);
+  }
+  return it->second;
+}
+
+shared_ptr<PreparedStatements>
+StatementManifest::prepare(Connection & conn) const {
+  vector<shared_ptr<SQLStatement> > stmts;
+  stmts.reserve(queries.size());
+  for (size_t id = 0; id < queries.size(); id++) {
+    try {
+      stmts.push_back(conn.prepare(queries[id]));
+    } catch (SQLException & e) {
+      throw SQLException(e.getType(), "Statement " + names[id] + ": " + e.getErrorMsg(), queries[id]);
+    }
+  }
+  return make_shared<PreparedStatements>(ids, std::move(stmts));
+}
+
+vector<shared_ptr<PreparedStatements> >
+StatementManifest::prepare(const vector<shared_ptr<Connection> > & conns, size_t num_threads) const {
+  vector<shared_ptr<PreparedStatements> > r(conns.size());
+  if (conns.size() == 1) {
+    r[0] = prepare(*conns[0]);
+    return r;
+  }
+
+  ThreadPool pool(num_threads ? num_threads : conns.size());
+  vector<future<void> > f;
+  for (size_t i = 0; i < conns.size(); i++) {
+    f.push_back(pool.submit([this, &conns, &r, i]() { r[i] = prepare(*conns[i]); }));
+  }
+  // the failure of the first connection is reported, but only after all
+  // threads have stopped using the connections
+  exception_ptr error;
+  for (auto & task : f) {
+    try {
+      task.get();
+    } catch (...) {
+      if (!error) error = current_exception();
+    }
+  }
+  if (error) rethrow_exception(error);
+  return r;
+}
+
+SQLStatement &
+PreparedStatements::get(const string & name) {
+  auto it = ids.find(name);
+  if (it == ids.end()) {
+    throw SQLException(SQLException::PREPARE_FAILED, "Unknown statement " + name);
+  }
+  return get(it->second);
+}
@@ -0,0 +1,129 @@
+#include "Synthetic.h"
+
+#include <cstring>
+
+using namespace std;
+using namespace sqldb;
+
+std::shared_ptr<SQLStatement>
+Synthetic::prepare(const string & query) {
+  auto r = std::make_shared<SyntheticStatement>(query, options);
+  r->setMemoryTracker(createStatementTracker());
+  return r;
+}
+
+SyntheticStatement::SyntheticStatement(const string & _query, const SyntheticOptions & _options)
+  : SQLStatement(_query),
+    options(_options)
+{
+  // placeholders are only counted so that bind errors match real backends
+  vector<string> parameter_names;
+  rewriteNamedParameters(_query, parameter_names);
+  num_parameters = parameter_names.size();
+  for (unsigned int i = 0; i < parameter_names.size(); i++) {
+    addNamedParameter(parameter_names[i], i + 1);
+  }
+
+  columns.resize(options.column_types.size());
+  for (unsigned int i = 0; i < columns.size(); i++) {
+    columns[i].name = "c" + to_string(i);
+    columns[i].type = options.column_types[i];
+    columns[i].size = options.value_size;
+  }
+}
+
+unsigned int
+SyntheticStatement::execute() {
+  is_query_executed = true;
+  results_available = false;
+  current_row = 0;
+  rows_affected = options.affected_rows;
+  last_insert_id += rows_affected;
+  return rows_affected;
+}
+
+bool
+SyntheticStatement::next() {
+  if (!is_query_executed) {
+    execute();
+  } else if (results_available) {
+    current_row++;
+  }
+  results_available = current_row < options.num_rows;
+  return results_available;
+}
+
+void
+SyntheticStatement::reset() {
+  SQLStatement::reset();
+  is_query_executed = false;
+  results_available = false;
+  current_row = 0;
+}
+
+SyntheticStatement &
+SyntheticStatement::bindNext() {
+  if (getNextBindIndex() > num_parameters) {
+    throw SQLException(SQLException::BAD_BIND_INDEX, "", getQuery());
+  }
+  return *this;
+}
+
+long long
+SyntheticStatement::getValue(int column_index) const {
+  if (column_index < 0 || column_index >= (int)columns.size()) {
+    throw SQLException(SQLException::BAD_COLUMN_INDEX, "", getQuery());
+  }
+  return (long long)current_row * (long long)columns.size() + column_index;
+}
+
+bool
+SyntheticStatement::isNumeric(int column_index) const {
+  ColumnType type = getColumnInfo(column_index).type;
+  return type == INT || type == INT64 || type == DOUBLE;
+}
+
+string
+SyntheticStatement::getText(int column_index) {
+  ColumnType type = getColumnInfo(column_index).type;
+  if (type == INT || type == INT64) {
+    return to_string(getValue(column_index));
+  } else if (type == DOUBLE) {
+    return to_string(getDouble(column_index));
+  }
+  return string(options.value_size, getFillChar(column_index));
+}
+
+ustring
+SyntheticStatement::getBlob(int column_index) {
+  return ustring(options.value_size, (unsigned char)getFillChar(column_index));
+}
+
+size_t
+SyntheticStatement::getBlobSize(int column_index) {
+  if (isNumeric(column_index)) return getText(column_index).size();
+  getValue(column_index);
+  return options.value_size;
+}
+
+size_t
+SyntheticStatement::readBlob(int column_index, size_t offset, void * buffer, size_t len) {
+  if (isNumeric(column_index)) {
+    string s = getText(column_index);
+    if (offset >= s.size()) return 0;
+    if (len > s.size() - offset) len = s.size() - offset;
+    memcpy(buffer, s.data() + offset, len);
+    return len;
+  }
+  char c = getFillChar(column_index);
+  if (offset >= options.value_size) return 0;
+  if (len > options.value_size - offset) len = options.value_size - offset;
+  memset(buffer, c, len);
+  return len;
+}
+
+bool
+SyntheticStatement::isNull(int column_index) {
+  getValue(column_index);
+  return !results_available;
+}
@@ -0,0 +1,37 @@
+#include "ThreadPool.h"
+
+using namespace std;
+using namespace sqldb;
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  if (!num_threads) num_threads = std::thread::hardware_concurrency();
+  if (!num_threads) num_threads = 1;
+  for (size_t i = 0; i < num_threads; i++) {
+    workers.emplace_back([this] { run(); });
+  }
+}
+
+// Runs the remaining queued tasks before the workers exit
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<std::mutex> guard(mutex);
+    is_running = false;
+  }
+  cond.notify_all();
+  for (auto & t : workers) t.join();
+}
+
+void
+ThreadPool::run() {
+  while ( 1 ) {
+    std::function<void ()> task;
+    {
+      unique_lock<std::mutex> lock(mutex);
+      cond.wait(lock, [this] { return !is_running || !queue.empty(); });
+      if (queue.empty()) return;
+      task = std::move(queue.front());
+      queue.pop_front();
+    }
+    task();
+  }
+}
@@ -0,0 +1,111 @@
+#include "Transaction.h"
+
+#include "SQLException.h"
+
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+using namespace sqldb;
+
+// Transaction depth of the connections used by this thread
+static thread_local unordered_map<Connection *, unsigned int> transaction_depth;
+
+static void
+rollbackQuietly(Connection & conn) {
+  try {
+    conn.rollback();
+  } catch (...) {
+  }
+}
+
+static void
+runSavepoint(Connection & conn, unsigned int depth, const std::function<void ()> & func) {
+  string name = "sqldb_sp" + to_string(depth);
+  conn.savepoint(name);
+  transaction_depth[&conn] = depth + 1;
+  try {
+    func();
+  } catch (...) {
+    transaction_depth[&conn] = depth;
+    try {
+      conn.rollbackToSavepoint(name);
+      conn.releaseSavepoint(name);
+    } catch (...) {
+    }
+    throw;
+  }
+  transaction_depth[&conn] = depth;
+  conn.releaseSavepoint(name);
+}
+
+// Half of the delay is fixed and half is random so that conflicting
+// clients spread out
+static chrono::microseconds
+getBackoff(const TransactionPolicy & policy, unsigned int attempt) {
+  static thread_local mt19937 rng(random_device{}());
+  double delay = chrono::duration<double, micro>(policy.initial_backoff).count();
+  for (unsigned int i = 1; i < attempt; i++) delay *= policy.backoff_multiplier;
+  double max_delay = chrono::duration<double, micro>(policy.max_backoff).count();
+  if (delay > max_delay) delay = max_delay;
+  uniform_real_distribution<double> jitter(0.0, delay / 2);
+  return chrono::microseconds((long long)(delay / 2 + jitter(rng)));
+}
+
+static void
+addTimeLost(const TransactionPolicy & policy, chrono::steady_clock::time_point since) {
+  policy.stats->time_lost_us += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - since).count();
+}
+
+void
+sqldb::runTransaction(Connection & conn, const std::function<void ()> & func, const TransactionPolicy & policy) {
+  auto it = transaction_depth.find(&conn);
+  if (it != transaction_depth.end() && it->second > 0) {
+    runSavepoint(conn, it->second, func);
+    return;
+  }
+
+  auto started = chrono::steady_clock::now();
+  for (unsigned int attempt = 1; ; attempt++) {
+    auto attempt_started = chrono::steady_clock::now();
+    try {
+      conn.begin();
+      transaction_depth[&conn] = 1;
+      func();
+      transaction_depth.erase(&conn);
+      conn.commit();
+      if (policy.stats) policy.stats->transactions++;
+      return;
+    } catch (SQLException & e) {
+      transaction_depth.erase(&conn);
+      rollbackQuietly(conn);
+
+      auto now = chrono::steady_clock::now();
+      auto backoff = getBackoff(policy, attempt);
+      bool retry = e.isRetryable() && attempt < policy.max_attempts &&
+	(policy.deadline.count() == 0 || now + backoff < started + policy.deadline);
+      if (!retry) {
+	if (policy.stats) {
+	  policy.stats->failures++;
+	  addTimeLost(policy, attempt_started);
+	}
+	throw;
+      }
+      std::this_thread::sleep_for(backoff);
+      if (policy.stats) {
+	policy.stats->retries++;
+	addTimeLost(policy, attempt_started);
+      }
+    } catch (...) {
+      transaction_depth.erase(&conn);
+      rollbackQuietly(conn);
+      if (policy.stats) {
+	policy.stats->failures++;
+	addTimeLost(policy, attempt_started);
+      }
+      throw;
+    }
+  }
+}
@@ -0,0 +1,265 @@
+#include "WorkloadLog.h"
+
+#include "SQLException.h"
+
+#include <cstring>
+#include <unordered_map>
+
+using namespace std;
+using namespace sqldb;
+
+// Records are stored in host byte order after the file header
+static const char log_magic[8] = { 'S', 'Q', 'L', 'D', 'B', 'L', 'O', 'G' };
+static const uint32_t log_version = 1;
+
+static atomic<unsigned long long> next_log_id{1};
+
+template <class T>
+static void
+put(string & buffer, T value) {
+  buffer.append((const char *)&value, sizeof(T));
+}
+
+template <class T>
+static bool
+get(const char *& ptr, const char * end, T & value) {
+  if (end - ptr < (ptrdiff_t)sizeof(T)) return false;
+  memcpy(&value, ptr, sizeof(T));
+  ptr += sizeof(T);
+  return true;
+}
+
+bool
+WorkloadLog::Ring::push(const char * data, size_t len) {
+  size_t h = head.load(std::memory_order_relaxed);
+  size_t t = tail.load(std::memory_order_acquire);
+  if (capacity - (h - t) < len) {
+    return false;
+  }
+  size_t pos = h % capacity;
+  size_t n = len < capacity - pos ? len : capacity - pos;
+  memcpy(buffer.get() + pos, data, n);
+  if (n < len) memcpy(buffer.get(), data + n, len - n);
+  head.store(h + len, std::memory_order_release);
+  return true;
+}
+
+size_t
+WorkloadLog::Ring::drain(FILE * out) {
+  size_t t = tail.load(std::memory_order_relaxed);
+  size_t h = head.load(std::memory_order_acquire);
+  size_t len = h - t;
+  if (!len) return 0;
+  size_t pos = t % capacity;
+  size_t n = len < capacity - pos ? len : capacity - pos;
+  fwrite(buffer.get() + pos, 1, n, out);
+  if (n < len) fwrite(buffer.get(), 1, len - n, out);
+  tail.store(h, std::memory_order_release);
+  return len;
+}
+
+WorkloadLog::WorkloadLog(const string & filename, size_t _ring_size)
+  : ring_size(_ring_size),
+    id(next_log_id++),
+    started(chrono::steady_clock::now())
+{
+  out = fopen(filename.c_str(), "wb");
+  if (!out) {
+    throw SQLException(SQLException::DATABASE_ERROR, "Cannot open " + filename);
+  }
+  fwrite(log_magic, 1, sizeof(log_magic), out);
+  fwrite(&log_version, sizeof(log_version), 1, out);
+  writer = std::thread([this] { run(); });
+}
+
+WorkloadLog::~WorkloadLog() {
+  is_running = false;
+  writer.join();
+  fclose(out);
+}
+
+unsigned long long
+WorkloadLog::getTimestamp() const {
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count();
+}
+
+// Rings of a thread by log id. They are released when the thread exits,
+// and the map does not keep the rings of destroyed logs alive.
+struct WorkloadLog::ThreadRings {
+  ~ThreadRings() {
+    for (auto & r : rings) {
+      if (auto ring = r.second.lock()) ring->release();
+    }
+  }
+
+  std::unordered_map<unsigned long long, std::weak_ptr<Ring> > rings;
+  // the most recently used log
+  unsigned long long last_log_id = 0;
+  Ring * last_ring = 0;
+};
+
+WorkloadLog::Ring *
+WorkloadLog::getRing() {
+  static thread_local ThreadRings thread_rings;
+  if (thread_rings.last_log_id == id) {
+    return thread_rings.last_ring;
+  }
+
+  shared_ptr<Ring> ring;
+  auto it = thread_rings.rings.find(id);
+  if (it != thread_rings.rings.end()) ring = it->second.lock();
+  if (!ring) {
+    // a thread takes a ring once per log, preferably one of an exited thread
+    {
+      lock_guard<mutex> guard(rings_mutex);
+      for (auto & r : rings) {
+	if (r->acquire()) {
+	  ring = r;
+	  break;
+	}
+      }
+      if (!ring) {
+	ring = make_shared<Ring>(ring_size);
+	rings.push_back(ring);
+      }
+    }
+    for (auto it = thread_rings.rings.begin(); it != thread_rings.rings.end(); ) {
+      if (it->second.expired()) it = thread_rings.rings.erase(it);
+      else it++;
+    }
+    thread_rings.rings[id] = ring;
+  }
+  thread_rings.last_log_id = id;
+  thread_rings.last_ring = ring.get();
+  return ring.get();
+}
+
+void
+WorkloadLog::append(const WorkloadRecord & record) {
+  static thread_local string buffer;
+  buffer.clear();
+  put<uint32_t>(buffer, 0);
+  put<uint8_t>(buffer, record.type);
+  put<uint32_t>(buffer, record.session);
+  put<uint64_t>(buffer, record.timestamp_ns);
+  put<uint64_t>(buffer, record.statement_id);
+  put<uint64_t>(buffer, record.duration_ns);
+  put<uint64_t>(buffer, record.rows);
+  if (record.type == WorkloadRecord::PREPARE || record.type == WorkloadRecord::QUERY) {
+    buffer += record.query;
+  } else if (record.type == WorkloadRecord::EXECUTE || record.type == WorkloadRecord::BATCH_ADD) {
+    put<uint16_t>(buffer, (uint16_t)record.parameters.size());
+    for (auto & p : record.parameters) {
+      put<uint8_t>(buffer, p.type);
+      switch (p.type) {
+      case WorkloadParameter::NULL_VALUE: break;
+      case WorkloadParameter::INT: put<int64_t>(buffer, p.int_value); break;
+      case WorkloadParameter::DOUBLE: put<double>(buffer, p.double_value); break;
+      case WorkloadParameter::TEXT:
+      case WorkloadParameter::BLOB:
+	put<uint32_t>(buffer, (uint32_t)p.data.size());
+	buffer += p.data;
+	break;
+      }
+    }
+  }
+  uint32_t len = (uint32_t)buffer.size();
+  memcpy(&buffer[0], &len, sizeof(len));
+
+  if (!getRing()->push(buffer.data(), buffer.size())) {
+    dropped_records++;
+  }
+}
+
+size_t
+WorkloadLog::drainAll() {
+  vector<Ring *> current;
+  {
+    lock_guard<mutex> guard(rings_mutex);
+    for (auto & r : rings) current.push_back(r.get());
+  }
+  size_t n = 0;
+  for (Ring * r : current) n += r->drain(out);
+  written_bytes += n;
+  return n;
+}
+
+void
+WorkloadLog::run() {
+  while (is_running) {
+    if (!drainAll()) {
+      std::this_thread::sleep_for(chrono::milliseconds(1));
+    }
+  }
+  drainAll();
+  fflush(out);
+}
+
+std::vector<WorkloadRecord>
+WorkloadLog::read(const string & filename) {
+  FILE * in = fopen(filename.c_str(), "rb");
+  if (!in) {
+    throw SQLException(SQLException::DATABASE_ERROR, "Cannot open " + filename);
+  }
+  char magic[sizeof(log_magic)];
+  uint32_t version = 0;
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, log_magic, sizeof(magic)) != 0 ||
+      fread(&version, sizeof(version), 1, in) != 1 || version != log_version) {
+    fclose(in);
+    throw SQLException(SQLException::DATABASE_ERROR, "Not a workload log: " + filename);
+  }
+
+  vector<WorkloadRecord> records;
+  vector<char> data;
+  while ( 1 ) {
+    uint32_t len;
+    if (fread(&len, sizeof(len), 1, in) != 1 || len < sizeof(len)) break;
+    data.resize(len - sizeof(len));
+    if (fread(data.data(), 1, data.size(), in) != data.size()) break;
+
+    const char * ptr = data.data(), * end = data.data() + data.size();
+    WorkloadRecord r;
+    uint8_t type;
+    uint32_t session;
+    uint64_t timestamp, statement_id, duration, rows;
+    if (!get(ptr, end, type) || !get(ptr, end, session) || !get(ptr, end, timestamp) ||
+	!get(ptr, end, statement_id) || !get(ptr, end, duration) || !get(ptr, end, rows)) {
+      break;
+    }
+    r.type = (WorkloadRecord::Type)type;
+    r.session = session;
+    r.timestamp_ns = timestamp;
+    r.statement_id = statement_id;
+    r.duration_ns = duration;
+    r.rows = rows;
+    if (r.type == WorkloadRecord::PREPARE || r.type == WorkloadRecord::QUERY) {
+      r.query.assign(ptr, end);
+    } else if (r.type == WorkloadRecord::EXECUTE || r.type == WorkloadRecord::BATCH_ADD) {
+      uint16_t n = 0;
+      get(ptr, end, n);
+      for (unsigned int i = 0; i < n; i++) {
+	WorkloadParameter p;
+	uint8_t ptype = 0;
+	if (!get(ptr, end, ptype)) break;
+	p.type = (WorkloadParameter::Type)ptype;
+	if (p.type == WorkloadParameter::INT) {
+	  int64_t v = 0;
+	  get(ptr, end, v);
+	  p.int_value = v;
+	} else if (p.type == WorkloadParameter::DOUBLE) {
+	  get(ptr, end, p.double_value);
+	} else if (p.type == WorkloadParameter::TEXT || p.type == WorkloadParameter::BLOB) {
+	  uint32_t size = 0;
+	  get(ptr, end, size);
+	  if (end - ptr < (ptrdiff_t)size) break;
+	  p.data.assign(ptr, size);
+	  ptr += size;
+	}
+	r.parameters.push_back(p);
+      }
+    }
+    records.push_back(r);
+  }
+  fclose(in);
+  return records;
+}
@@ -0,0 +1,108 @@
+// Measures ODBC fetch throughput with different row array sizes, with and
+// without a long column in the result.
+//
+//   odbc_fetch_bench [-n rows] [-a size,size,...] DSN
+//
+// DSN is a data source name or a connection string such as
+// "Driver=SQLite3;Database=/tmp/bench.db". The table sqldb_fetch_bench is
+// created, filled with parameter arrays and dropped at the end.
+
+#include "ODBC.h"
+#include "SQLException.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+using namespace sqldb;
+
+static void
+usage() {
+  cerr << "usage: odbc_fetch_bench [-n rows] [-a size,size,...] DSN\n";
+  exit(1);
+}
+
+static void
+fill(ODBC & db, unsigned int num_rows) {
+  db.execute("DROP TABLE IF EXISTS sqldb_fetch_bench");
+  db.execute("CREATE TABLE sqldb_fetch_bench (id INTEGER, name VARCHAR(32), value DOUBLE PRECISION, body TEXT)");
+
+  auto start = chrono::steady_clock::now();
+  db.begin();
+  auto stmt = db.prepare("INSERT INTO sqldb_fetch_bench (id, name, value, body) VALUES (?, ?, ?, ?)");
+  string body(1000, 'x');
+  for (unsigned int i = 0; i < num_rows; i++) {
+    stmt->bind(i);
+    stmt->bind("name " + to_string(i));
+    stmt->bind(i * 0.5);
+    stmt->bind(body);
+    stmt->addBatch();
+  }
+  stmt->executeBatch();
+  db.commit();
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  cout << "insert: " << num_rows << " rows in " << elapsed << " s\n";
+}
+
+static void
+run(ODBC & db, const char * label, const char * query, size_t row_array_size) {
+  auto stmt = db.prepare(query);
+  dynamic_pointer_cast<ODBCStatement>(stmt)->setRowArraySize(row_array_size);
+
+  auto start = chrono::steady_clock::now();
+  unsigned long long rows = 0, bytes = 0;
+  while (stmt->next()) {
+    rows++;
+    for (unsigned int i = 0; i < stmt->getNumFields(); i++) {
+      bytes += stmt->getText(i).size();
+    }
+  }
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  cout << label << " array " << row_array_size << ": " << rows << " rows, " << bytes << " bytes in "
+       << elapsed << " s (" << (elapsed > 0 ? rows / elapsed : 0) << " rows/s)\n";
+}
+
+int
+main(int argc, char ** argv) {
+  unsigned int num_rows = 100000;
+  vector<size_t> sizes = { 1, 16, ODBC_ROW_ARRAY_SIZE };
+  string dsn;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      num_rows = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+      sizes.clear();
+      istringstream input(argv[++i]);
+      string size;
+      while (getline(input, size, ',')) {
+	if (atoi(size.c_str()) > 0) sizes.push_back(atoi(size.c_str()));
+      }
+    } else if (argv[i][0] != '-' && dsn.empty()) {
+      dsn = argv[i];
+    } else {
+      usage();
+    }
+  }
+  if (dsn.empty() || sizes.empty()) usage();
+
+  ODBC db(dsn);
+  if (!db.connect()) return 1;
+
+  try {
+    fill(db, num_rows);
+    for (size_t size : sizes) {
+      run(db, "short", "SELECT id, name, value FROM sqldb_fetch_bench", size);
+      run(db, "long", "SELECT id, name, value, body FROM sqldb_fetch_bench", size);
+    }
+    db.execute("DROP TABLE sqldb_fetch_bench");
+  } catch (SQLException & e) {
+    cerr << "benchmark failed: " << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
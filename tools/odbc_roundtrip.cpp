@@ -0,0 +1,114 @@
+// Writes rows through an ODBC driver with parameter arrays, reads them back
+// and checks every value. Exits with status 1 on the first mismatch.
+//
+//   odbc_roundtrip [-n rows] DSN
+//
+// e.g. odbc_roundtrip "Driver=SQLite3;Database=/tmp/roundtrip.db" with the
+// SQLite ODBC driver. The table sqldb_roundtrip is created and dropped.
+
+#include "ODBC.h"
+#include "SQLException.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace std;
+using namespace sqldb;
+
+static string
+getName(unsigned int i) {
+  return i % 7 == 0 ? string(100 + i % 50, 'a' + i % 26) : "name " + to_string(i);
+}
+
+static string
+getBody(unsigned int i) {
+  return i % 5 == 0 ? string(20000 + i, 'b') : "body " + to_string(i);
+}
+
+static bool
+check(SQLStatement & stmt, unsigned int row, size_t row_array_size) {
+  int id = stmt.getInt(0);
+  bool is_null = id % 3 == 0;
+  string error;
+  if (id != (int)row) {
+    error = "id";
+  } else if (stmt.getText(1) != getName(id)) {
+    error = "name";
+  } else if (stmt.isNull(2) != is_null || (!is_null && stmt.getDouble(2) != id * 0.25)) {
+    error = "value";
+  } else if (stmt.getText(3) != getBody(id)) {
+    error = "body";
+  }
+  if (!error.empty()) {
+    cerr << "mismatch in " << error << " of row " << row << " with row array size " << row_array_size << endl;
+    return false;
+  }
+  return true;
+}
+
+int
+main(int argc, char ** argv) {
+  unsigned int num_rows = 10000;
+  string dsn;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      num_rows = atoi(argv[++i]);
+    } else if (argv[i][0] != '-' && dsn.empty()) {
+      dsn = argv[i];
+    } else {
+      cerr << "usage: odbc_roundtrip [-n rows] DSN\n";
+      return 1;
+    }
+  }
+  if (dsn.empty()) {
+    cerr << "usage: odbc_roundtrip [-n rows] DSN\n";
+    return 1;
+  }
+
+  ODBC db(dsn);
+  if (!db.connect()) return 1;
+
+  try {
+    db.execute("DROP TABLE IF EXISTS sqldb_roundtrip");
+    db.execute("CREATE TABLE sqldb_roundtrip (id INTEGER, name VARCHAR(16), value DOUBLE PRECISION, body TEXT)");
+
+    auto insert = db.prepare("INSERT INTO sqldb_roundtrip (id, name, value, body) VALUES (?, ?, ?, ?)");
+    for (unsigned int i = 0; i < num_rows; i++) {
+      insert->bind(i);
+      insert->bind(getName(i));
+      insert->bind(i * 0.25, i % 3 != 0);
+      insert->bind(getBody(i));
+      insert->addBatch();
+    }
+    unsigned int n = insert->executeBatch();
+    if (n != num_rows) {
+      cerr << "inserted " << n << " rows instead of " << num_rows << endl;
+      return 1;
+    }
+
+    // single rows, and blocks with long values read after the block
+    for (size_t row_array_size : { 1, ODBC_ROW_ARRAY_SIZE }) {
+      auto select = db.prepare("SELECT id, name, value, body FROM sqldb_roundtrip ORDER BY id");
+      dynamic_pointer_cast<ODBCStatement>(select)->setRowArraySize(row_array_size);
+      unsigned int row = 0;
+      while (select->next()) {
+	if (!check(*select, row, row_array_size)) return 1;
+	row++;
+      }
+      if (row != num_rows) {
+	cerr << "read " << row << " rows instead of " << num_rows << endl;
+	return 1;
+      }
+    }
+
+    db.execute("DROP TABLE sqldb_roundtrip");
+  } catch (SQLException & e) {
+    cerr << "round trip failed: " << e.what() << endl;
+    return 1;
+  }
+  cout << num_rows << " rows written and read back\n";
+  return 0;
+}
@@ -0,0 +1,180 @@
+// Replays a workload log recorded with RecordingConnection against an
+// SQLite file or a MySQL server.
+//
+//   replay [-s speed] [-c threads] --sqlite FILE LOG
+//   replay [-s speed] [-c threads] --mysql HOST PORT USER PASSWORD DB LOG
+//
+// speed 1 keeps the recorded timing, N replays N times faster and 0 runs
+// as fast as possible. Each recorded session gets its own connection and
+// sessions are divided between the threads.
+
+#include "WorkloadLog.h"
+#include "SQLite.h"
+#include "MySQL.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <thread>
+
+using namespace std;
+using namespace sqldb;
+
+struct replay_stats_s {
+  atomic<unsigned long long> statements{0};
+  atomic<unsigned long long> errors{0};
+  atomic<unsigned long long> rows{0};
+  atomic<unsigned long long> recorded_ns{0};
+  atomic<unsigned long long> replayed_ns{0};
+};
+
+static void
+bindParameters(SQLStatement & stmt, const vector<WorkloadParameter> & parameters) {
+  for (auto & p : parameters) {
+    switch (p.type) {
+    case WorkloadParameter::NULL_VALUE: stmt.bind(0, false); break;
+    case WorkloadParameter::INT: stmt.bind(p.int_value); break;
+    case WorkloadParameter::DOUBLE: stmt.bind(p.double_value); break;
+    case WorkloadParameter::TEXT: stmt.bind(p.data); break;
+    case WorkloadParameter::BLOB: stmt.bind((const void *)p.data.data(), p.data.size()); break;
+    }
+  }
+}
+
+static void
+runWorker(const vector<const WorkloadRecord *> & records, const function<shared_ptr<Connection> ()> & connect,
+	  double speed, chrono::steady_clock::time_point started, replay_stats_s & stats) {
+  map<unsigned int, shared_ptr<Connection> > connections;
+  map<unsigned long long, shared_ptr<SQLStatement> > statements;
+
+  for (const WorkloadRecord * r : records) {
+    if (speed > 0) {
+      this_thread::sleep_until(started + chrono::nanoseconds((long long)(r->timestamp_ns / speed)));
+    }
+    auto & conn = connections[r->session];
+    if (!conn) conn = connect();
+
+    auto t0 = chrono::steady_clock::now();
+    try {
+      switch (r->type) {
+      case WorkloadRecord::PREPARE:
+	statements[r->statement_id] = conn->prepare(r->query);
+	break;
+      case WorkloadRecord::EXECUTE:
+	{
+	  auto & stmt = statements[r->statement_id];
+	  if (!stmt) break;
+	  stmt->reset();
+	  bindParameters(*stmt, r->parameters);
+	  if (stmt->getNumFields()) {
+	    while (stmt->next()) stats.rows++;
+	  } else {
+	    stmt->execute();
+	  }
+	}
+	break;
+      case WorkloadRecord::BATCH_ADD:
+	{
+	  auto & stmt = statements[r->statement_id];
+	  if (!stmt) break;
+	  bindParameters(*stmt, r->parameters);
+	  stmt->addBatch();
+	}
+	break;
+      case WorkloadRecord::BATCH_EXECUTE:
+	if (statements[r->statement_id]) statements[r->statement_id]->executeBatch();
+	break;
+      case WorkloadRecord::QUERY: conn->execute(r->query); break;
+      case WorkloadRecord::BEGIN: conn->begin(); break;
+      case WorkloadRecord::COMMIT: conn->commit(); break;
+      case WorkloadRecord::ROLLBACK: conn->rollback(); break;
+      case WorkloadRecord::ROWS: continue;
+      }
+    } catch (SQLException & e) {
+      stats.errors++;
+    }
+    stats.statements++;
+    stats.recorded_ns += r->duration_ns;
+    stats.replayed_ns += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count();
+  }
+}
+
+static void
+usage() {
+  cerr << "usage: replay [-s speed] [-c threads] --sqlite FILE LOG\n"
+       << "       replay [-s speed] [-c threads] --mysql HOST PORT USER PASSWORD DB LOG\n";
+  exit(1);
+}
+
+int
+main(int argc, char ** argv) {
+  double speed = 1;
+  unsigned int num_threads = 4;
+  function<shared_ptr<Connection> ()> connect;
+  string log_file;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      speed = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+      num_threads = atoi(argv[++i]);
+      if (!num_threads) num_threads = 1;
+    } else if (!strcmp(argv[i], "--sqlite") && i + 1 < argc) {
+      string db_file = argv[++i];
+      connect = [db_file]() { return make_shared<SQLite>(db_file); };
+    } else if (!strcmp(argv[i], "--mysql") && i + 5 < argc) {
+      string host = argv[i + 1], user = argv[i + 3], password = argv[i + 4], db = argv[i + 5];
+      int port = atoi(argv[i + 2]);
+      i += 5;
+      connect = [=]() {
+	auto conn = make_shared<MySQL>();
+	if (!conn->connect(host, port, user, password, db)) {
+	  throw SQLException(SQLException::DATABASE_ERROR, "Cannot connect to " + host);
+	}
+	return conn;
+      };
+    } else if (argv[i][0] != '-' && log_file.empty()) {
+      log_file = argv[i];
+    } else {
+      usage();
+    }
+  }
+  if (!connect || log_file.empty()) usage();
+
+  vector<WorkloadRecord> records = WorkloadLog::read(log_file);
+  stable_sort(records.begin(), records.end(), [](const WorkloadRecord & a, const WorkloadRecord & b) {
+    return a.timestamp_ns < b.timestamp_ns;
+  });
+
+  // sessions are kept on one thread so that their transactions stay intact
+  vector<vector<const WorkloadRecord *> > work(num_threads);
+  for (auto & r : records) {
+    work[r.session % num_threads].push_back(&r);
+  }
+
+  replay_stats_s stats;
+  auto started = chrono::steady_clock::now();
+  vector<thread> threads;
+  for (auto & w : work) {
+    threads.emplace_back([&] {
+      try {
+	runWorker(w, connect, speed, started, stats);
+      } catch (exception & e) {
+	cerr << "worker failed: " << e.what() << endl;
+      }
+    });
+  }
+  for (auto & t : threads) t.join();
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+  cout << "records: " << records.size() << "\n"
+       << "statements: " << stats.statements << ", errors: " << stats.errors << ", rows: " << stats.rows << "\n"
+       << "recorded time: " << stats.recorded_ns / 1e9 << " s, replayed time: " << stats.replayed_ns / 1e9 << " s\n"
+       << "wall time: " << elapsed << " s\n";
+  return 0;
+}
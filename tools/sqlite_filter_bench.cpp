@@ -0,0 +1,113 @@
+// Compares filtering rows inside SQLite with a function registered through
+// createFunction() against fetching every row and filtering on the client.
+//
+//   sqlite_filter_bench [-n rows] [-r repeats] [FILE]
+//
+// The table sqldb_filter_bench is created in FILE (an in-memory database by
+// default) and dropped at the end.
+
+#include "SQLite.h"
+#include "SQLException.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+using namespace std;
+using namespace sqldb;
+
+// The predicate of both variants: a score range and a name prefix
+static bool
+isMatch(double score, string_view name) {
+  return score >= 0.25 && score < 0.5 && name.substr(0, 5) == "name1";
+}
+
+static void
+usage() {
+  cerr << "usage: sqlite_filter_bench [-n rows] [-r repeats] [FILE]\n";
+  exit(1);
+}
+
+static void
+fill(SQLite & db, unsigned int num_rows) {
+  db.execute("DROP TABLE IF EXISTS sqldb_filter_bench");
+  db.execute("CREATE TABLE sqldb_filter_bench (id INTEGER PRIMARY KEY, name TEXT, score REAL, payload TEXT)");
+  db.begin();
+  auto stmt = db.prepare("INSERT INTO sqldb_filter_bench (id, name, score, payload) VALUES (?, ?, ?, ?)");
+  string payload(200, 'x');
+  for (unsigned int i = 0; i < num_rows; i++) {
+    stmt->reset();
+    stmt->bind(i);
+    stmt->bind("name" + to_string(i % 1000));
+    stmt->bind((i * 7919 % 10007) / 10007.0);
+    stmt->bind(payload);
+    stmt->execute();
+  }
+  db.commit();
+}
+
+static void
+measure(const char * label, unsigned int repeats, const function<unsigned long long ()> & run) {
+  unsigned long long rows = 0;
+  auto start = chrono::steady_clock::now();
+  for (unsigned int i = 0; i < repeats; i++) rows = run();
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count() / repeats;
+  cout << label << ": " << rows << " rows in " << elapsed * 1000 << " ms\n";
+}
+
+int
+main(int argc, char ** argv) {
+  unsigned int num_rows = 1000000, repeats = 3;
+  string db_file = ":memory:";
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      num_rows = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+      repeats = atoi(argv[++i]);
+      if (!repeats) repeats = 1;
+    } else if (argv[i][0] != '-') {
+      db_file = argv[i];
+    } else {
+      usage();
+    }
+  }
+
+  try {
+    SQLite db(db_file);
+    fill(db, num_rows);
+    db.createFunction("is_match", [](double score, string_view name) { return isMatch(score, name); });
+
+    auto in_engine = db.prepare("SELECT id, name, payload FROM sqldb_filter_bench WHERE is_match(score, name)");
+    measure("in engine", repeats, [&] {
+      unsigned long long rows = 0;
+      in_engine->reset();
+      while (in_engine->next()) {
+	rows += in_engine->getText(2).empty() ? 0 : 1;
+      }
+      return rows;
+    });
+
+    auto client = db.prepare("SELECT id, name, payload, score FROM sqldb_filter_bench");
+    measure("client side", repeats, [&] {
+      unsigned long long rows = 0;
+      client->reset();
+      while (client->next()) {
+	if (isMatch(client->getDouble(3), client->getText(1))) {
+	  rows += client->getText(2).empty() ? 0 : 1;
+	}
+      }
+      return rows;
+    });
+
+    db.execute("DROP TABLE sqldb_filter_bench");
+  } catch (SQLException & e) {
+    cerr << "benchmark failed: " << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}